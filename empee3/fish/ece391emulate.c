@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "ece391support.h"
@@ -121,13 +122,35 @@ ece391_open (const uint8_t* filename)
 	return dir_fd;
     }
 
+    /* Files are writable now, fall back to read-only for the rest */
     asm volatile ("INT $0x80" : "=a" (rval) :
-		  "a" (5), "b" (filename), "c" (O_RDONLY));
+		  "a" (5), "b" (filename), "c" (O_RDWR));
+    if (rval > 0xFFFFC000)
+        asm volatile ("INT $0x80" : "=a" (rval) :
+		      "a" (5), "b" (filename), "c" (O_RDONLY));
     if (rval > 0xFFFFC000)
         return -1;
     return rval;
 }
 
+int32_t 
+ece391_create (const uint8_t* filename)
+{
+    int fd;
+
+    if (-1 == (fd = open ((const char*)filename, O_WRONLY | O_CREAT | O_TRUNC,
+		          0644)))
+        return -1;
+    (void)close (fd);
+    return 0;
+}
+
+int32_t 
+ece391_unlink (const uint8_t* filename)
+{
+    return unlink ((const char*)filename);
+}
+
 int32_t 
 ece391_getargs (uint8_t* buf, int32_t nbytes)
 {
@@ -176,6 +199,24 @@ ece391_vidmap (uint8_t** screen_start)
     return 0;
 }
 
+int32_t 
+ece391_mmap (int32_t fd, uint8_t** start)
+{
+    off_t len;
+    void* file_image;
+
+    if (dir_fd == fd || -1 == (len = lseek (fd, 0, SEEK_END)))
+        return -1;
+    (void)lseek (fd, 0, SEEK_SET);
+
+    if ((file_image = mmap ((void*)0, len, PROT_READ, MAP_PRIVATE,
+                    fd, 0)) == MAP_FAILED)
+        return -1;
+
+    *start = (uint8_t*)file_image;
+    return len;
+}
+
 int32_t 
 ece391_read (int32_t fd, void* buf, int32_t nbytes)
 {
@@ -205,6 +246,126 @@ ece391_read (int32_t fd, void* buf, int32_t nbytes)
     return copied;
 }
 
+int32_t 
+ece391_getdents (int32_t fd, void* buf, int32_t nbytes)
+{
+    struct dirent* de;
+    struct stat st;
+    ece391_dirent_t* rec = buf;
+    int32_t idx, filled;
+
+    if (NULL == dir || dir_fd != fd || nbytes < sizeof (*rec))
+        return -1;
+    for (filled = 0; filled + sizeof (*rec) <= nbytes; filled += sizeof (*rec)) {
+        if (NULL == (de = readdir (dir)))
+	    break;
+	for (idx = 0; 32 > idx; idx++) {
+	    rec->name[idx] = de->d_name[idx];
+	    if ('\0' == de->d_name[idx])
+	        break;
+	}
+	while (32 > idx)
+	    rec->name[idx++] = '\0';
+	rec->inode = de->d_ino;
+	rec->type = 1;
+	rec->length = 0;
+	if (0 == stat (de->d_name, &st) && S_ISREG (st.st_mode)) {
+	    rec->type = 2;
+	    rec->length = st.st_size;
+	}
+	rec++;
+    }
+    return filled;
+}
+
+static int32_t
+copy_stat (const struct stat* st, ece391_stat_t* buf)
+{
+    buf->inode = st->st_ino;
+    buf->type = 1;
+    buf->size = 0;
+    buf->blocks = 0;
+    if (S_ISREG (st->st_mode)) {
+        buf->type = 2;
+	buf->size = st->st_size;
+	buf->blocks = (st->st_size + 4095) / 4096;
+    }
+    return 0;
+}
+
+int32_t 
+ece391_stat (const uint8_t* filename, ece391_stat_t* buf)
+{
+    struct stat st;
+
+    if (-1 == stat ((const char*)filename, &st))
+        return -1;
+    return copy_stat (&st, buf);
+}
+
+int32_t 
+ece391_fstat (int32_t fd, ece391_stat_t* buf)
+{
+    struct stat st;
+
+    if (NULL != dir && dir_fd == fd)
+        return ece391_stat ((uint8_t*)".", buf);
+    if (-1 == fstat (fd, &st))
+        return -1;
+    return copy_stat (&st, buf);
+}
+
+int32_t 
+ece391_lseek (int32_t fd, int32_t offset, int32_t whence)
+{
+    if (NULL != dir && dir_fd == fd)
+        return -1;
+    return lseek (fd, offset, whence);
+}
+
+int32_t 
+ece391_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset)
+{
+    if (NULL != dir && dir_fd == fd)
+        return -1;
+    return pread (fd, buf, nbytes, offset);
+}
+
+int32_t 
+ece391_sbrk (int32_t increment)
+{
+    void* old = sbrk (increment);
+
+    if ((void*)-1 == old)
+        return -1;
+    return (int32_t)old;
+}
+
+int32_t 
+ece391_brk (void* addr)
+{
+    return brk (addr);
+}
+
+int32_t 
+ece391_fork (void)
+{
+    return fork ();
+}
+
+int32_t 
+ece391_wait (int32_t* status)
+{
+    int st;
+    pid_t pid = waitpid (-1, &st, 0);
+
+    if (-1 == pid)
+        return -1;
+    if (NULL != status)
+        *status = WIFEXITED (st) ? WEXITSTATUS (st) : 256;
+    return pid;
+}
+
 int32_t 
 ece391_write (int32_t fd, const void* buf, int32_t nbytes)
 {
@@ -20,5 +20,66 @@ extern int32_t ece391_close (int32_t fd);
 extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 
+/* Maps an open regular file read-only; returns its length, -1 on failure */
+extern int32_t ece391_mmap (int32_t fd, uint8_t** start);
+/* Creates an empty regular file (truncates an existing one) */
+extern int32_t ece391_create (const uint8_t* filename);
+/* Removes a regular file */
+extern int32_t ece391_unlink (const uint8_t* filename);
+
+/* One directory record; name is not NUL-terminated when it is 32 chars long */
+typedef struct ece391_dirent {
+    uint8_t name[32];
+    int32_t type;
+    int32_t inode;
+    int32_t length;
+} ece391_dirent_t;
+
+/*
+ * Fills buf with as many directory records as fit; returns the number of
+ * bytes filled, 0 at the end of the directory
+ */
+extern int32_t ece391_getdents (int32_t fd, void* buf, int32_t nbytes);
+
+/* File metadata; size and blocks are 0 for anything but regular files */
+typedef struct ece391_stat {
+    int32_t type;
+    int32_t inode;
+    uint32_t size;
+    uint32_t blocks;
+} ece391_stat_t;
+
+extern int32_t ece391_stat (const uint8_t* filename, ece391_stat_t* buf);
+extern int32_t ece391_fstat (int32_t fd, ece391_stat_t* buf);
+
+/* Moves the file position; returns the new position */
+#define ECE391_SEEK_SET 0
+#define ECE391_SEEK_CUR 1
+#define ECE391_SEEK_END 2
+extern int32_t ece391_lseek (int32_t fd, int32_t offset, int32_t whence);
+/* Reads at offset without moving the file position */
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+
+/*
+ * Grows the heap by increment bytes (shrinks it when negative); returns the
+ * old end of the heap. Heap pages are zero filled on first touch
+ */
+extern int32_t ece391_sbrk (int32_t increment);
+/* Sets the end of the heap; returns 0 */
+extern int32_t ece391_brk (void* addr);
+
+/*
+ * Creates a copy of the calling program that runs alongside it; returns the
+ * child's pid in the parent and 0 in the child. Memory is copied on write,
+ * open files are duplicated with their own positions
+ */
+extern int32_t ece391_fork (void);
+/*
+ * Waits for a forked child to halt and stores its halt status (256 if an
+ * exception killed it) in *status unless status is NULL; returns the
+ * child's pid, -1 if there are no forked children
+ */
+extern int32_t ece391_wait (int32_t* status);
+
 #endif /* ECE391SYSCALL_H */
 
@@ -8,6 +8,7 @@
 uint8_t *vmem_base_addr;
 uint8_t *mp1_set_video_mode (void);
 void add_frames(uint8_t *, uint8_t *, int32_t);
+int32_t frame_getc(int32_t, uint8_t *, int32_t, int32_t *, uint8_t *);
 void ece391_memset(void* memory, char c, int n);
 int32_t ece391_memcpy(void* dest, const void* src, int32_t n);
 
@@ -18,15 +19,11 @@ uint8_t file1[] = "frame1.txt";
 extern int mp1_ioctl(unsigned long arg, unsigned long cmd);
 extern void mp1_rtc_tasklet(unsigned long trash);
 
-static struct mp1_blink_struct blink_array[80*25];
-
 int main(void)
 {
     int rtc_fd, ret_val, i, garbage;
     struct mp1_blink_struct blink_struct;
 
-    ece391_memset(blink_array, 0, sizeof(struct mp1_blink_struct)*80*25);
-
     if(mp1_set_video_mode() == NULL) {
         return -1;
     }
@@ -79,7 +76,8 @@ void
 add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
 {
     int32_t row, col, offset = 40, eof0 = 0, eof1 = 0, num_bytes;
-    int32_t fd0, fd1;
+    int32_t fd0, fd1, len0, len1, pos0 = 0, pos1 = 0;
+    uint8_t *data0, *data1;
     struct mp1_blink_struct blink_struct;
     uint8_t c0 = '0', c1 = '0';
 
@@ -95,12 +93,20 @@ add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
         ece391_halt(-1);
     }
 
+    /* Map the frames so we can walk them without a syscall per byte */
+    if( (len0 = ece391_mmap(fd0, &data0)) < 0 ) {
+        data0 = NULL;
+    }
+    if( (len1 = ece391_mmap(fd1, &data1)) < 0 ) {
+        data1 = NULL;
+    }
+
     while(eof0 == 0 || eof1 == 0) {
         col = 0;
         while(1) {
 
             if(c0 != '\n') {
-                num_bytes = ece391_read(fd0, &c0, 1);
+                num_bytes = frame_getc(fd0, data0, len0, &pos0, &c0);
                 if(num_bytes == 0) {
                     c0 = '\n';
                     eof0 = 1;
@@ -108,7 +114,7 @@ add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
             }
 
             if(c1 != '\n') {
-                num_bytes = ece391_read(fd1, &c1, 1);
+                num_bytes = frame_getc(fd1, data1, len1, &pos1, &c1);
                 if(num_bytes == 0) {
                     c1 = '\n';
                     eof1 = 1;
@@ -147,6 +153,22 @@ add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
     }
 }
 
+/* Reads the next frame character from the mapping, or from fd if it is not mapped */
+int32_t
+frame_getc(int32_t fd, uint8_t *data, int32_t len, int32_t *pos, uint8_t *c)
+{
+    if(data == NULL) {
+        return ece391_read(fd, c, 1);
+    }
+
+    if(*pos >= len) {
+        return 0;
+    }
+
+    *c = data[(*pos)++];
+    return 1;
+}
+
 uint8_t*
 mp1_set_video_mode (void)
 {
@@ -159,19 +181,12 @@ mp1_set_video_mode (void)
 
 void* mp1_malloc(int32_t size)
 {
-    int32_t i;
-    for(i=0; i< 80*25; i++) {
-        if(blink_array[i].location == 0) {
-            return &blink_array[i];
-        }
-    }
-
-    return NULL;
+    return ece391_malloc(size);
 }
 
 void mp1_free(void* memory)
 {
-    ece391_memset(memory, 0, sizeof(struct mp1_blink_struct));
+    ece391_free(memory);
 }
 
 void ece391_memset(void* memory, char c, int n)
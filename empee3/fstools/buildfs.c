@@ -0,0 +1,344 @@
+/*
+ * buildfs - builds a file system image from a directory, or reports on one
+ *
+ * usage: buildfs [-z] [-H] [-i inodes] [-o order file] <source dir> <out image>
+ *        buildfs -r <image>
+ *
+ * The image has the boot_t/inode_t layout of student-distrib/filesys.h. The
+ * "." and "rtc" dentries come first, then the regular files of the source
+ * directory sorted by name, or in the order given by the order file (one
+ * name per line, most frequently used first; unlisted files follow by name).
+ * Inode i + 1 holds the i-th file and its data blocks are allocated
+ * contiguously, files laid out back to back in directory order.
+ *
+ *   -z  store non-executable files LZ-compressed when that saves a block
+ *   -H  store each name's FNV-1a hash in its dentry for the kernel's name index
+ *   -i  number of inode blocks (default 64, or enough for every file)
+ *   -r  print per-file extents and fragmentation statistics for an image
+ */
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fsimg.h"
+
+#define DEFAULT_INODES  64
+#define MAX_FILES       (MAX_DENTRIES - 2)
+#define UNLISTED        MAX_DENTRIES
+
+typedef struct file {
+    char name[FILENAME_LEN + 1];
+    char path[1024];
+    uint32_t blocks;
+    int rank;
+} file_t;
+
+static const uint8_t elf_magic[4] = {0x7F, 'E', 'L', 'F'};
+
+static uint32_t
+name_hash (const char* name)
+{
+    uint32_t hash = FNV_OFFSET;
+    int i;
+
+    for (i = 0; i < FILENAME_LEN && '\0' != name[i]; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static int
+file_cmp (const void* a, const void* b)
+{
+    const file_t* fa = a;
+    const file_t* fb = b;
+
+    if (fa->rank != fb->rank)
+        return fa->rank - fb->rank;
+    return strcmp (fa->name, fb->name);
+}
+
+/* Collects the regular files of dir, returns how many or -1 */
+static int
+scan_dir (const char* dir, file_t* files)
+{
+    DIR* d;
+    struct dirent* ent;
+    struct stat st;
+    char path[1024];
+    int n = 0;
+
+    if (NULL == (d = opendir (dir))) {
+        perror (dir);
+        return -1;
+    }
+    while (NULL != (ent = readdir (d))) {
+        if ('.' == ent->d_name[0])
+            continue;
+        snprintf (path, sizeof (path), "%s/%s", dir, ent->d_name);
+        if (0 != stat (path, &st) || !S_ISREG (st.st_mode))
+            continue;
+        if (MAX_FILES == n) {
+            fprintf (stderr, "%s: more than %d files\n", dir, MAX_FILES);
+            closedir (d);
+            return -1;
+        }
+        strcpy (files[n].path, path);
+        files[n].blocks = (st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (strlen (ent->d_name) > FILENAME_LEN)
+            fprintf (stderr, "%s: name truncated to %d characters\n", ent->d_name, FILENAME_LEN);
+        strncpy (files[n].name, ent->d_name, FILENAME_LEN);
+        files[n].name[FILENAME_LEN] = '\0';
+        files[n].rank = UNLISTED;
+        n++;
+    }
+    closedir (d);
+    return n;
+}
+
+/* Ranks files by their line in the order file, returns 0 on success */
+static int
+read_order (const char* path, file_t* files, int n)
+{
+    FILE* f;
+    char line[256];
+    int rank = 0, i;
+
+    if (NULL == (f = fopen (path, "r"))) {
+        perror (path);
+        return -1;
+    }
+    while (NULL != fgets (line, sizeof (line), f)) {
+        line[strcspn (line, "\r\n")] = '\0';
+        for (i = 0; i < n; i++) {
+            if (0 == strncmp (files[i].name, line, FILENAME_LEN) && UNLISTED == files[i].rank) {
+                files[i].rank = rank++;
+                break;
+            }
+        }
+    }
+    fclose (f);
+    return 0;
+}
+
+/* Reads a whole file into buf, returns its size or -1 */
+static int32_t
+read_file (const char* path, uint8_t* buf)
+{
+    FILE* f;
+    size_t size;
+
+    if (NULL == (f = fopen (path, "rb"))) {
+        perror (path);
+        return -1;
+    }
+    size = fread (buf, 1, MAX_FILE_BLOCKS * BLOCK_SIZE + 1, f);
+    fclose (f);
+    if (size > MAX_FILE_BLOCKS * BLOCK_SIZE) {
+        fprintf (stderr, "%s: larger than %d blocks\n", path, MAX_FILE_BLOCKS);
+        return -1;
+    }
+    return size;
+}
+
+static void
+add_dentry (boot_t* boot, const char* name, int32_t type, int32_t inode, int hashed)
+{
+    dentry_t* d = &boot->direntries[boot->dir_count++];
+
+    strncpy (d->filename, name, FILENAME_LEN);
+    d->filetype = type;
+    d->inode_num = inode;
+    if (hashed)
+        *(uint32_t*)d->reserved = name_hash (d->filename);
+}
+
+static int
+build (const char* dir, const char* out_path, const char* order,
+       int compress, int hashed, int32_t inode_count)
+{
+    static file_t files[MAX_FILES];
+    boot_t* boot;
+    inode_t* inodes;
+    uint8_t* out;
+    uint8_t* data;
+    uint8_t* stream;
+    uint8_t* blocks_out;
+    uint32_t next_block = 0, max_blocks, blocks, len, b;
+    int32_t size;
+    int n, i, compressed;
+    FILE* f;
+
+    if (-1 == (n = scan_dir (dir, files)) || (NULL != order && 0 != read_order (order, files, n)))
+        return 2;
+    qsort (files, n, sizeof (files[0]), file_cmp);
+
+    if (inode_count < n + 1)
+        inode_count = n + 1;
+    if (inode_count > MAX_INODES) {
+        fprintf (stderr, "too many inodes\n");
+        return 2;
+    }
+
+    /* Files never take more blocks than their raw size */
+    max_blocks = 0;
+    for (i = 0; i < n; i++)
+        max_blocks += files[i].blocks;
+    out = calloc (1 + inode_count + max_blocks, BLOCK_SIZE);
+    data = malloc (MAX_FILE_BLOCKS * BLOCK_SIZE + 1);
+    stream = malloc ((MAX_FILE_BLOCKS + 1) * BLOCK_SIZE);
+    if (NULL == out || NULL == data || NULL == stream)
+        return 2;
+
+    boot = (boot_t*)out;
+    inodes = (inode_t*)(out + BLOCK_SIZE);
+    blocks_out = out + BLOCK_SIZE * (1 + inode_count);
+    boot->inode_count = inode_count;
+    if (hashed)
+        *(uint32_t*)boot->reserved = NAME_HASH_MAGIC;
+
+    add_dentry (boot, ".", DIR_FILE, 0, hashed);
+    add_dentry (boot, "rtc", RTC_FILE, 0, hashed);
+
+    for (i = 0; i < n; i++) {
+        if (-1 == (size = read_file (files[i].path, data)))
+            return 2;
+
+        len = fsimg_make_stream (data, size, stream,
+                                 compress && (size < 4 || 0 != memcmp (data, elf_magic, 4)),
+                                 &compressed);
+        blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (blocks > files[i].blocks) {
+            fprintf (stderr, "%s: changed while building\n", files[i].path);
+            return 2;
+        }
+
+        add_dentry (boot, files[i].name, REG_FILE, i + 1, hashed);
+        inodes[i + 1].length = size | (compressed ? INODE_COMPRESSED : 0);
+        for (b = 0; b < blocks; b++)
+            inodes[i + 1].data_block_num[b] = next_block + b;
+        memcpy (blocks_out + next_block * BLOCK_SIZE, stream, len);
+        next_block += blocks;
+    }
+    boot->data_count = next_block;
+
+    if (NULL == (f = fopen (out_path, "wb")) ||
+        1 != fwrite (out, BLOCK_SIZE * (1 + inode_count + next_block), 1, f)) {
+        perror (out_path);
+        return 2;
+    }
+    fclose (f);
+    printf ("%s: %d files, %d inodes, %u data blocks\n", out_path, n, inode_count, next_block);
+    return 0;
+}
+
+static int
+report (const char* path)
+{
+    fsimg_t img;
+    dentry_t* d;
+    inode_t* node;
+    uint8_t* used;
+    int32_t blocks;
+    uint32_t i, b, extents, size;
+    uint32_t files = 0, fragmented = 0, total_extents = 0, used_blocks = 0;
+    uint32_t unreferenced = 0, out_of_order = 0, bad_hashes = 0, compressed = 0;
+    int32_t last_block = -1;
+    int hashed;
+
+    if (0 != fsimg_load (path, &img))
+        return 2;
+    if (NULL == (used = calloc (img.boot->data_count + 1, 1)))
+        return 2;
+    hashed = (NAME_HASH_MAGIC == *(uint32_t*)img.boot->reserved);
+
+    printf ("%-32s %8s %6s %7s\n", "name", "size", "blocks", "extents");
+    for (i = 0; i < img.boot->dir_count; i++) {
+        d = &img.boot->direntries[i];
+        if (hashed && *(uint32_t*)d->reserved != name_hash (d->filename))
+            bad_hashes++;
+        if (REG_FILE != d->filetype)
+            continue;
+        if (-1 == (blocks = fsimg_file_blocks (&img, d->inode_num))) {
+            printf ("%-32.32s bad inode %d\n", d->filename, d->inode_num);
+            continue;
+        }
+        node = img.inodes + d->inode_num;
+        size = node->length & ~INODE_COMPRESSED;
+
+        /* An extent is a run of consecutive block numbers */
+        extents = 0;
+        for (b = 0; b < blocks; b++) {
+            if (node->data_block_num[b] < img.boot->data_count)
+                used[node->data_block_num[b]] = 1;
+            if (0 == b || node->data_block_num[b] != node->data_block_num[b - 1] + 1)
+                extents++;
+        }
+        /* Files not starting right after the previous one cost a seek */
+        if (0 != blocks) {
+            if (node->data_block_num[0] != last_block + 1)
+                out_of_order++;
+            last_block = node->data_block_num[blocks - 1];
+        }
+
+        printf ("%-32.32s %8u %6d %7u%s\n", d->filename, size, blocks, extents,
+                (node->length & INODE_COMPRESSED) ? " compressed" : "");
+        files++;
+        total_extents += extents;
+        if (extents > 1)
+            fragmented++;
+        if (node->length & INODE_COMPRESSED)
+            compressed++;
+    }
+
+    for (b = 0; b < img.boot->data_count; b++) {
+        if (used[b])
+            used_blocks++;
+        else
+            unreferenced++;
+    }
+
+    printf ("\n%u dentries, %d inodes, %d data blocks\n",
+            img.boot->dir_count, img.boot->inode_count, img.boot->data_count);
+    printf ("%u files (%u compressed), %u blocks in use, %u unreferenced\n",
+            files, compressed, used_blocks, unreferenced);
+    printf ("%u extents, %u fragmented files, %u files out of directory order\n",
+            total_extents, fragmented, out_of_order);
+    if (hashed)
+        printf ("name hashes present, %u wrong\n", bad_hashes);
+    else
+        printf ("no name hashes\n");
+    return 0;
+}
+
+int
+main (int argc, char* argv[])
+{
+    const char* order = NULL;
+    int compress = 0, hashed = 0, opt;
+    int32_t inode_count = DEFAULT_INODES;
+
+    if (3 == argc && 0 == strcmp (argv[1], "-r"))
+        return report (argv[2]);
+
+    while (-1 != (opt = getopt (argc, argv, "zHi:o:"))) {
+        switch (opt) {
+            case 'z': compress = 1; break;
+            case 'H': hashed = 1; break;
+            case 'i': inode_count = atoi (optarg); break;
+            case 'o': order = optarg; break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind + 2 != argc) {
+        fprintf (stderr, "usage: %s [-z] [-H] [-i inodes] [-o order file] "
+                 "<source dir> <out image>\n", argv[0]);
+        fprintf (stderr, "       %s -r <image>\n", argv[0]);
+        return 1;
+    }
+    return build (argv[optind], argv[optind + 1], order, compress, hashed, inode_count);
+}
@@ -0,0 +1,92 @@
+/*
+ * compressfs - rewrites a file system image with eligible files compressed
+ *
+ * usage: compressfs <in image> <out image>
+ *
+ * Every regular file that is not an ELF executable (programs are paged in on
+ * demand and stay raw) and shrinks by at least one block is stored as an LZ
+ * stream with INODE_COMPRESSED set in its inode. Data blocks are repacked so
+ * each file's blocks are contiguous, in directory order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsimg.h"
+
+static const uint8_t elf_magic[4] = {0x7F, 'E', 'L', 'F'};
+
+int
+main (int argc, char* argv[])
+{
+    fsimg_t in;
+    boot_t* boot;
+    inode_t* inodes;
+    uint8_t* out;
+    uint8_t* data;
+    uint8_t* stream;
+    uint32_t next_block = 0, raw_blocks = 0, blocks, i, b;
+    uint8_t inode_done[MAX_INODES] = {0};
+    int32_t size;
+    uint32_t len;
+    int compressed;
+    FILE* f;
+    dentry_t* d;
+
+    if (3 != argc) {
+        fprintf (stderr, "usage: %s <in image> <out image>\n", argv[0]);
+        return 1;
+    }
+    if (0 != fsimg_load (argv[1], &in))
+        return 2;
+
+    /* Output is never bigger than the input */
+    out = calloc (1, in.size);
+    data = malloc (MAX_FILE_BLOCKS * BLOCK_SIZE);
+    stream = malloc ((MAX_FILE_BLOCKS + 1) * BLOCK_SIZE);
+    if (NULL == out || NULL == data || NULL == stream)
+        return 2;
+
+    boot = (boot_t*)out;
+    memcpy (boot, in.boot, sizeof (boot_t));
+    inodes = (inode_t*)(out + BLOCK_SIZE);
+
+    for (i = 0; i < in.boot->dir_count; i++) {
+        d = &in.boot->direntries[i];
+        if (REG_FILE != d->filetype || d->inode_num >= in.boot->inode_count ||
+            d->inode_num >= MAX_INODES || inode_done[d->inode_num])
+            continue;
+        inode_done[d->inode_num] = 1;
+
+        if (-1 == (size = fsimg_read_file (&in, d->inode_num, data))) {
+            fprintf (stderr, "%.32s: unreadable, skipped\n", d->filename);
+            continue;
+        }
+
+        len = fsimg_make_stream (data, size, stream,
+                                 size < 4 || 0 != memcmp (data, elf_magic, 4), &compressed);
+        blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        raw_blocks += (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+        inodes[d->inode_num].length = size | (compressed ? INODE_COMPRESSED : 0);
+        for (b = 0; b < blocks; b++)
+            inodes[d->inode_num].data_block_num[b] = next_block + b;
+        memcpy (out + BLOCK_SIZE * (1 + in.boot->inode_count + next_block), stream, len);
+        next_block += blocks;
+
+        if (compressed)
+            printf ("%-32.32s %7d -> %7u bytes, %3u -> %3u blocks\n", d->filename,
+                    size, len, (size + BLOCK_SIZE - 1) / BLOCK_SIZE, blocks);
+    }
+
+    boot->data_count = next_block;
+    printf ("data blocks: %u raw, %u stored\n", raw_blocks, next_block);
+
+    if (NULL == (f = fopen (argv[2], "wb")) ||
+        1 != fwrite (out, BLOCK_SIZE * (1 + in.boot->inode_count + next_block), 1, f)) {
+        perror (argv[2]);
+        return 2;
+    }
+    fclose (f);
+    return 0;
+}
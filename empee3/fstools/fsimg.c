@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsimg.h"
+#include "lz.h"
+
+int
+fsimg_load (const char* path, fsimg_t* img)
+{
+    FILE* f;
+    long size;
+
+    if (NULL == (f = fopen (path, "rb"))) {
+        perror (path);
+        return -1;
+    }
+    fseek (f, 0, SEEK_END);
+    size = ftell (f);
+    fseek (f, 0, SEEK_SET);
+
+    if (size < BLOCK_SIZE || NULL == (img->base = malloc (size)) ||
+        size != fread (img->base, 1, size, f)) {
+        fprintf (stderr, "%s: not a file system image\n", path);
+        fclose (f);
+        return -1;
+    }
+    fclose (f);
+
+    img->size = size;
+    img->boot = (boot_t*)img->base;
+    img->inodes = (inode_t*)(img->base + BLOCK_SIZE);
+    img->data = img->base + BLOCK_SIZE * (1 + img->boot->inode_count);
+
+    if (img->boot->dir_count > MAX_DENTRIES ||
+        BLOCK_SIZE * (1 + img->boot->inode_count + img->boot->data_count) > size) {
+        fprintf (stderr, "%s: bad boot block\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Copies len bytes of a file's block stream starting at offset */
+static int
+copy_stream (const fsimg_t* img, const inode_t* node, uint32_t offset,
+             uint8_t* buf, uint32_t len)
+{
+    uint32_t block, part;
+
+    while (0 != len) {
+        block = node->data_block_num[offset / BLOCK_SIZE];
+        if (block >= img->boot->data_count)
+            return -1;
+        part = BLOCK_SIZE - offset % BLOCK_SIZE;
+        if (part > len)
+            part = len;
+        memcpy (buf, img->data + block * BLOCK_SIZE + offset % BLOCK_SIZE, part);
+        buf += part;
+        offset += part;
+        len -= part;
+    }
+    return 0;
+}
+
+int32_t
+fsimg_read_file (const fsimg_t* img, uint32_t inode, uint8_t* buf)
+{
+    const inode_t* node = img->inodes + inode;
+    uint32_t size = node->length & ~INODE_COMPRESSED;
+    uint32_t table[MAX_FILE_BLOCKS + 1];
+    uint8_t chunk[BLOCK_SIZE];
+    uint32_t entries, i, block_len, chunk_len;
+
+    if (inode >= img->boot->inode_count || size > MAX_FILE_BLOCKS * BLOCK_SIZE)
+        return -1;
+
+    if (!(node->length & INODE_COMPRESSED))
+        return copy_stream (img, node, 0, buf, size) ? -1 : size;
+
+    entries = LZ_TABLE_ENTRIES (size);
+    if (copy_stream (img, node, 0, (uint8_t*)table, entries * sizeof (uint32_t)))
+        return -1;
+    for (i = 0; i + 1 < entries; i++) {
+        block_len = (size - i * BLOCK_SIZE < BLOCK_SIZE) ? size - i * BLOCK_SIZE : BLOCK_SIZE;
+        chunk_len = table[i + 1] - table[i];
+        if (table[i + 1] < table[i] || chunk_len > block_len ||
+            copy_stream (img, node, table[i], chunk, chunk_len))
+            return -1;
+        if (chunk_len == block_len)
+            memcpy (buf + i * BLOCK_SIZE, chunk, block_len);
+        else if (-1 == lz_decompress (chunk, chunk_len, buf + i * BLOCK_SIZE, block_len))
+            return -1;
+    }
+    return size;
+}
+
+int32_t
+fsimg_file_blocks (const fsimg_t* img, uint32_t inode)
+{
+    const inode_t* node = img->inodes + inode;
+    uint32_t size = node->length & ~INODE_COMPRESSED;
+    uint32_t block;
+
+    if (inode >= img->boot->inode_count || size > MAX_FILE_BLOCKS * BLOCK_SIZE)
+        return -1;
+    if (!(node->length & INODE_COMPRESSED))
+        return (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    /* The offset table always fits in the first block, its last entry is
+     * the length of the whole stream */
+    block = node->data_block_num[0];
+    if (block >= img->boot->data_count)
+        return -1;
+    return (((uint32_t*)(img->data + block * BLOCK_SIZE))[LZ_TABLE_ENTRIES (size) - 1] +
+            BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+uint32_t
+fsimg_make_stream (const uint8_t* data, uint32_t size, uint8_t* out,
+                   int try_compress, int* compressed)
+{
+    uint32_t entries = LZ_TABLE_ENTRIES (size);
+    uint32_t* table = (uint32_t*)out;
+    uint32_t pos, i, block_len;
+    int32_t chunk_len;
+
+    *compressed = 0;
+    if (try_compress && 0 != size) {
+        pos = entries * sizeof (uint32_t);
+        for (i = 0; i + 1 < entries; i++) {
+            table[i] = pos;
+            block_len = (size - i * BLOCK_SIZE < BLOCK_SIZE) ? size - i * BLOCK_SIZE : BLOCK_SIZE;
+            /* Blocks that don't shrink are stored raw */
+            chunk_len = lz_compress (data + i * BLOCK_SIZE, block_len, out + pos, block_len - 1);
+            if (-1 == chunk_len) {
+                memcpy (out + pos, data + i * BLOCK_SIZE, block_len);
+                chunk_len = block_len;
+            }
+            pos += chunk_len;
+        }
+        table[i] = pos;
+
+        /* Only worth it if the file ends up in fewer blocks */
+        if ((pos + BLOCK_SIZE - 1) / BLOCK_SIZE < (size + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+            *compressed = 1;
+            return pos;
+        }
+    }
+
+    memcpy (out, data, size);
+    return size;
+}
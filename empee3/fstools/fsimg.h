@@ -0,0 +1,69 @@
+#if !defined(FSIMG_H)
+#define FSIMG_H
+
+#include <stdint.h>
+
+/* On-disk format of the boot file system image (see student-distrib/filesys.h) */
+#define BLOCK_SIZE          4096
+#define FILENAME_LEN        32
+#define MAX_DENTRIES        63
+#define MAX_FILE_BLOCKS     1023
+#define MAX_INODES          1023
+
+#define RTC_FILE            0
+#define DIR_FILE            1
+#define REG_FILE            2
+
+/* Set in an inode's length when its blocks hold an LZ stream */
+#define INODE_COMPRESSED    0x40000000
+/* Entries in the offset table at the front of a compressed stream */
+#define LZ_TABLE_ENTRIES(size)  (((size) + BLOCK_SIZE - 1) / BLOCK_SIZE + 1)
+
+/* Precomputed name hashes: FNV-1a of each name in the first four reserved
+ * bytes of its dentry, flagged by this magic at the start of the boot
+ * block's reserved area */
+#define NAME_HASH_MAGIC     0x31485348
+#define FNV_OFFSET          2166136261u
+#define FNV_PRIME           16777619
+
+typedef struct dentry {
+    char filename[FILENAME_LEN];
+    int32_t filetype;
+    int32_t inode_num;
+    int8_t reserved[24];
+} dentry_t;
+
+typedef struct boot_block {
+    int32_t dir_count;
+    int32_t inode_count;
+    int32_t data_count;
+    int8_t reserved[52];
+    dentry_t direntries[MAX_DENTRIES];
+} boot_t;
+
+typedef struct inode {
+    int32_t length;
+    int32_t data_block_num[MAX_FILE_BLOCKS];
+} inode_t;
+
+/* A whole image in memory */
+typedef struct fsimg {
+    uint8_t* base;
+    uint32_t size;
+    boot_t* boot;
+    inode_t* inodes;
+    uint8_t* data;
+} fsimg_t;
+
+/* Reads an image file, returns 0 on success */
+extern int fsimg_load (const char* path, fsimg_t* img);
+/* Copies out the contents of a file (decompressing if needed), returns its size or -1 */
+extern int32_t fsimg_read_file (const fsimg_t* img, uint32_t inode, uint8_t* buf);
+/* Number of data blocks a file occupies, or -1 */
+extern int32_t fsimg_file_blocks (const fsimg_t* img, uint32_t inode);
+/* Builds the block stream stored for a file, compressed if that saves a block;
+ * returns the stream length, *compressed tells which one it is */
+extern uint32_t fsimg_make_stream (const uint8_t* data, uint32_t size, uint8_t* out,
+                                   int try_compress, int* compressed);
+
+#endif /* FSIMG_H */
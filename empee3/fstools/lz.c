@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include "lz.h"
+
+/* Greedy matcher tuned for 4 kB blocks: positions fit in the hash table as is */
+#define HASH_BITS       12
+#define MAX_OFFSET      65535
+/* LZ4 block rules: the last match starts 12 bytes before the end, the last 5 bytes are literals */
+#define MF_LIMIT        12
+#define LAST_LITERALS   5
+
+static uint32_t
+read32 (const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t
+hash4 (const uint8_t* p)
+{
+    return (read32 (p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Writes a length nibble's extension bytes */
+static uint8_t*
+put_length (uint8_t* op, uint32_t length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/* Writes one sequence: literals [anchor, anchor + lit_len), then a match (if match_len != 0) */
+static uint8_t*
+put_sequence (uint8_t* op, const uint8_t* anchor, uint32_t lit_len,
+              uint32_t offset, uint32_t match_len)
+{
+    uint8_t* token = op++;
+    uint32_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    *token = ((lit_len < LZ_RUN_MASK ? lit_len : LZ_RUN_MASK) << 4) |
+             (ml < LZ_RUN_MASK ? ml : LZ_RUN_MASK);
+    if (lit_len >= LZ_RUN_MASK)
+        op = put_length (op, lit_len - LZ_RUN_MASK);
+    memcpy (op, anchor, lit_len);
+    op += lit_len;
+
+    if (0 != match_len) {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        if (ml >= LZ_RUN_MASK)
+            op = put_length (op, ml - LZ_RUN_MASK);
+    }
+    return op;
+}
+
+int32_t
+lz_compress (const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap)
+{
+    int32_t table[1 << HASH_BITS];
+    uint8_t tmp[2 * 65536];
+    uint8_t* op = tmp;
+    uint32_t ip = 0, anchor = 0, ref, match_len, h;
+
+    /* Worst case is a little over len, so compress into tmp and check cap at the end */
+    if (len > 65536)
+        return -1;
+    memset (table, -1, sizeof (table));
+
+    while (len >= MF_LIMIT + 1 && ip <= len - MF_LIMIT) {
+        h = hash4 (src + ip);
+        ref = table[h];
+        table[h] = ip;
+
+        if (-1 == (int32_t)ref || ip - ref > MAX_OFFSET ||
+            read32 (src + ref) != read32 (src + ip)) {
+            ip++;
+            continue;
+        }
+
+        match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len - LAST_LITERALS &&
+               src[ref + match_len] == src[ip + match_len])
+            match_len++;
+
+        op = put_sequence (op, src + anchor, ip - anchor, ip - ref, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = put_sequence (op, src + anchor, len - anchor, 0, 0);
+
+    if (op - tmp > cap)
+        return -1;
+    memcpy (dst, tmp, op - tmp);
+    return op - tmp;
+}
+
+int32_t
+lz_decompress (const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len)
+{
+    const uint8_t* ip = src;
+    const uint8_t* src_end = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* dst_end = dst + dst_len;
+    const uint8_t* match;
+    uint32_t token, length, offset;
+
+    while (ip < src_end) {
+        token = *ip++;
+
+        length = token >> 4;
+        if (LZ_RUN_MASK == length) {
+            do {
+                if (ip >= src_end)
+                    return -1;
+                length += *ip;
+            } while (255 == *ip++);
+        }
+        if (length > (uint32_t)(src_end - ip) || length > (uint32_t)(dst_end - op))
+            return -1;
+        memcpy (op, ip, length);
+        op += length;
+        ip += length;
+
+        if (ip == src_end)
+            break;
+
+        if (src_end - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (0 == offset || offset > (uint32_t)(op - dst))
+            return -1;
+
+        length = token & LZ_RUN_MASK;
+        if (LZ_RUN_MASK == length) {
+            do {
+                if (ip >= src_end)
+                    return -1;
+                length += *ip;
+            } while (255 == *ip++);
+        }
+        length += LZ_MIN_MATCH;
+        if (length > (uint32_t)(dst_end - op))
+            return -1;
+
+        match = op - offset;
+        while (length--)
+            *op++ = *match++;
+    }
+
+    return (op == dst_end) ? (int32_t)dst_len : -1;
+}
@@ -0,0 +1,15 @@
+#if !defined(LZ_H)
+#define LZ_H
+
+#include <stdint.h>
+
+/* LZ4 block format, same as the kernel's decoder (student-distrib/lz.c) */
+#define LZ_MIN_MATCH    4
+#define LZ_RUN_MASK     15
+
+/* Compresses src into dst, returns the compressed size or -1 if it would exceed cap */
+extern int32_t lz_compress (const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap);
+/* Decompresses exactly dst_len bytes, returns dst_len or -1 if corrupt */
+extern int32_t lz_decompress (const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len);
+
+#endif /* LZ_H */
@@ -1,18 +1,93 @@
 #include "filesys.h"
+#include "stats.h"
+#include "imgcache.h"
+#include "frame.h"
 
 uint32_t boot_addr;
 boot_t boot_block;
 dentry_t* dentries;
 inode_t* inodes;
 
+/* Size and block count of every inode, so stat and reads skip the inode block */
+fmeta_t fmeta[FS_MAX_INODES];
+
+/* Open-addressed name index: holds (dentry index + 1), 0 marks an empty slot */
+static uint8_t name_index[NAME_INDEX_SIZE];
+/* Hash of every dentry's name, compared before the names themselves */
+static uint32_t dentry_hash[MAX_DENTRIES];
+/* Set when the image stores the hashes in its dentries */
+static uint32_t hashes_stored;
+
+/* Lookup statistics for the name index */
+uint32_t name_lookups;
+uint32_t name_probes;
+uint32_t name_max_probe;
+
+/* Block cache, hash chains and LRU list (head is most recently used) */
+static bcache_entry_t bcache[BCACHE_SIZE];
+static int16_t bcache_hash[BCACHE_BUCKETS];
+static int16_t lru_head;
+static int16_t lru_tail;
+static uint8_t* data_blocks;
+
+uint32_t bcache_hits;
+uint32_t bcache_misses;
+uint32_t read_extents;
+
+/* Decompression cache, entries are reused round robin */
+static dcache_entry_t dcache[DCACHE_SIZE];
+static uint32_t dcache_next;
+static uint8_t lz_in[BLOCK_SIZE];
+
+uint32_t dcache_hits;
+uint32_t dcache_misses;
+
+/* Free data block bitmap (bit set = in use), inodes owned by a file,
+ * and where the next block allocation starts looking
+ */
+static uint32_t block_map[FS_MAX_BLOCKS / 32];
+/* Data blocks block_map covers: data_count, capped for an image left in its module */
+static uint32_t alloc_blocks;
+static uint8_t inode_used[FS_MAX_INODES];
+static uint32_t alloc_cursor;
+
+/* Open file objects, mmaps and running program images of each inode, and how
+ * many of those read the data blocks in place (mmaps and images). An unlinked
+ * inode keeps its blocks until its last reference goes
+ */
+static uint32_t inode_refs[FS_MAX_INODES];
+static uint32_t inode_pins[FS_MAX_INODES];
+static uint8_t inode_unlinked[FS_MAX_INODES];
+/* Running programs that demand-load their image from the file itself (no image
+ * cache slot holds a copy), the file cannot be written while any do
+ */
+static uint32_t inode_execs[FS_MAX_INODES];
+
+uint32_t fs_free_blocks;
+uint32_t fs_blocks_written;
+
+static uint32_t name_hash(const int8_t* name);
+static void name_index_build(void);
+static void bcache_init(void);
+static void bcache_invalidate(uint32_t inode);
+static void fs_region_init(void);
+static void free_map_build(void);
+static void fmeta_update(uint32_t inode);
+static int32_t read_compressed(uint32_t inode, uint32_t offset, uint8_t* buffer, uint32_t length);
+static int32_t write_data_unlocked(uint32_t inode, uint32_t offset, const uint8_t* buffer, uint32_t length);
+static int32_t fs_truncate_unlocked(uint32_t inode, uint32_t length);
+static void dir_entry_removed(uint32_t idx);
+static void fs_exec_ref(pcb_t* pcb, int32_t delta);
+
 /*
  * fs_init
  *   DESCRIPTION: Initializes file system driver
  *   INPUTS: boot - Address of boot block of the file system
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Copies status bytes to global variables,
- *                 set dentries/inodes pointers, and initializes fd_arr[]
+ *   SIDE EFFECTS: Copies status bytes to global variables, moves the image
+ *                 to FS_REGION, set dentries/inodes pointers, and builds the
+ *                 name index and free block map
  */
 void fs_init(uint32_t boot) {
     boot_addr = boot;
@@ -22,11 +97,462 @@ void fs_init(uint32_t boot) {
     memcpy(&boot_block.inode_count, (unsigned int*)(boot_addr + INODE_OFFSET), 4);
     memcpy(&boot_block.data_count, (unsigned int*)(boot_addr + DATA_OFFSET), 4);
 
+    /* Move the image somewhere it can grow */
+    fs_region_init();
+
     /* Dentries start after 64B stats field */
     dentries = (dentry_t*)(boot_addr + STATS_SIZE);
 
     /* Inodes start after boot block */
     inodes = (inode_t*)(boot_addr + BLOCK_SIZE);
+
+    /* Data blocks start after the inodes */
+    data_blocks = (uint8_t*)(boot_addr + (boot_block.inode_count) * BLOCK_SIZE + BLOCK_SIZE);
+
+    name_lookups = 0;
+    name_probes = 0;
+    name_max_probe = 0;
+
+    hashes_stored = (*(uint32_t*)(boot_addr + HASH_OFFSET) == NAME_HASH_MAGIC);
+    name_index_build();
+    bcache_init();
+    free_map_build();
+
+    stats_register("name_lookups", &name_lookups);
+    stats_register("name_probes", &name_probes);
+    stats_register("name_max_probe", &name_max_probe);
+    stats_register("bcache_hits", &bcache_hits);
+    stats_register("bcache_misses", &bcache_misses);
+    stats_register("read_extents", &read_extents);
+    stats_register("dcache_hits", &dcache_hits);
+    stats_register("dcache_misses", &dcache_misses);
+    stats_register("fs_free_blocks", &fs_free_blocks);
+    stats_register("fs_blocks_written", &fs_blocks_written);
+}
+
+/*
+ * name_hash
+ *   DESCRIPTION: FNV-1a hash over a filename (stops at EOS or FILENAME_LEN bytes)
+ *   INPUTS: name - filename, not necessarily EOS terminated
+ *   OUTPUTS: none
+ *   RETURN VALUE: 32-bit hash of the name
+ *   SIDE EFFECTS: none
+ */
+static uint32_t name_hash(const int8_t* name) {
+    uint32_t hash = FNV_OFFSET;
+    int i;
+
+    for(i = 0; (i < FILENAME_LEN) && (name[i] != '\0'); i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+ * name_index_build
+ *   DESCRIPTION: Inserts every dentry of the boot block into the name index,
+ *                called again whenever a file is created or unlinked
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Resets name_index[] and dentry_hash[]
+ */
+static void name_index_build(void) {
+    uint32_t idx;
+    uint32_t slot;
+
+    memset(name_index, 0, NAME_INDEX_SIZE);
+
+    for(idx = 0; idx < boot_block.dir_count; idx++) {
+        /* Use the builder's precomputed hash when the image has one */
+        if(hashes_stored)
+            dentry_hash[idx] = *(uint32_t*)(dentries+idx)->reserved;
+        else
+            dentry_hash[idx] = name_hash((dentries+idx)->filename);
+
+        /* Linear probing, table is always less than half full */
+        slot = dentry_hash[idx] & (NAME_INDEX_SIZE - 1);
+        while(name_index[slot] != 0)
+            slot = (slot + 1) & (NAME_INDEX_SIZE - 1);
+        name_index[slot] = idx + 1;
+    }
+}
+
+/*
+ * bcache_init
+ *   DESCRIPTION: Empties the block cache and links every entry into the LRU list
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Resets bcache[], dcache[] and the hit/miss counters
+ */
+static void bcache_init(void) {
+    int i;
+
+    for(i = 0; i < BCACHE_BUCKETS; i++)
+        bcache_hash[i] = BCACHE_EMPTY;
+
+    for(i = 0; i < BCACHE_SIZE; i++) {
+        bcache[i].inode = BCACHE_EMPTY;
+        bcache[i].prev = i - 1;
+        bcache[i].next = (i == BCACHE_SIZE - 1) ? BCACHE_EMPTY : i + 1;
+        bcache[i].hnext = BCACHE_EMPTY;
+    }
+    lru_head = 0;
+    lru_tail = BCACHE_SIZE - 1;
+
+    bcache_hits = 0;
+    bcache_misses = 0;
+    read_extents = 0;
+
+    for(i = 0; i < DCACHE_SIZE; i++)
+        dcache[i].inode = BCACHE_EMPTY;
+    dcache_next = 0;
+    dcache_hits = 0;
+    dcache_misses = 0;
+}
+
+/*
+ * lru_touch
+ *   DESCRIPTION: Moves a cache entry to the head (most recently used) of the LRU list
+ *   INPUTS: e - index of the entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Relinks the LRU list
+ */
+static void lru_touch(int16_t e) {
+    if(e == lru_head)
+        return;
+
+    /* Unlink (e is not the head, so it has a prev) */
+    bcache[bcache[e].prev].next = bcache[e].next;
+    if(bcache[e].next != BCACHE_EMPTY)
+        bcache[bcache[e].next].prev = bcache[e].prev;
+    else
+        lru_tail = bcache[e].prev;
+
+    /* Push to the front */
+    bcache[e].prev = BCACHE_EMPTY;
+    bcache[e].next = lru_head;
+    bcache[lru_head].prev = e;
+    lru_head = e;
+}
+
+/*
+ * fs_block
+ *   DESCRIPTION: Resolves the block-th data block of an inode through the block cache
+ *   INPUTS: inode - inode number, block - index into the inode's data_block_num[]
+ *   OUTPUTS: none
+ *   RETURN VALUE: Pointer to the start of the data block, NULL if the block number is bad
+ *   SIDE EFFECTS: Updates the LRU list and hit/miss counters, may recycle the LRU entry
+ */
+uint8_t* fs_block(uint32_t inode, uint32_t block) {
+    uint32_t run;
+
+    return fs_extent(inode, block, &run);
+}
+
+/*
+ * fs_extent
+ *   DESCRIPTION: Resolves the block-th data block of an inode through the block cache,
+ *                along with the number of following blocks of the file that sit right
+ *                after it in the image. The run is measured once when the block is
+ *                brought into the cache, so later reads of the extent are free
+ *   INPUTS: inode - inode number, block - index into the inode's data_block_num[]
+ *   OUTPUTS: run - number of contiguous blocks starting at the returned pointer (>= 1)
+ *   RETURN VALUE: Pointer to the start of the data block, NULL if the block number is bad
+ *   SIDE EFFECTS: Updates the LRU list and hit/miss counters, may recycle the LRU entry.
+ *                 Runs with interrupts off, a preempting reader would see half-linked lists
+ */
+uint8_t* fs_extent(uint32_t inode, uint32_t block, uint32_t* run) {
+    uint32_t bucket = (inode * 31 + block) & (BCACHE_BUCKETS - 1);
+    inode_t* node = inodes + inode;
+    uint32_t block_num, file_blocks, flags;
+    uint8_t* data;
+    int16_t* link;
+    int16_t e;
+
+    cli_and_save(flags);
+    for(e = bcache_hash[bucket]; e != BCACHE_EMPTY; e = bcache[e].hnext) {
+        if((bcache[e].inode == inode) && (bcache[e].block == block)) {
+            bcache_hits++;
+            lru_touch(e);
+            *run = bcache[e].run;
+            data = bcache[e].data;
+            restore_flags(flags);
+            return data;
+        }
+    }
+
+    /* Miss: walk the inode */
+    bcache_misses++;
+    block_num = node->data_block_num[block];
+    if(block_num >= boot_block.data_count) {
+        restore_flags(flags);
+        return NULL;
+    }
+
+    /* Recycle the least recently used entry */
+    e = lru_tail;
+    if(bcache[e].inode != BCACHE_EMPTY) {
+        link = &bcache_hash[(bcache[e].inode * 31 + bcache[e].block) & (BCACHE_BUCKETS - 1)];
+        while(*link != e)
+            link = &bcache[*link].hnext;
+        *link = bcache[e].hnext;
+    }
+
+    /* Measure the extent, stopping at the last block of the file */
+    file_blocks = fmeta[inode].blocks;
+    bcache[e].run = 1;
+    while((block + bcache[e].run < file_blocks) &&
+          (node->data_block_num[block + bcache[e].run] == block_num + bcache[e].run) &&
+          (block_num + bcache[e].run < boot_block.data_count))
+        bcache[e].run++;
+
+    bcache[e].inode = inode;
+    bcache[e].block = block;
+    bcache[e].data = data_blocks + block_num * BLOCK_SIZE;
+    bcache[e].hnext = bcache_hash[bucket];
+    bcache_hash[bucket] = e;
+    lru_touch(e);
+
+    *run = bcache[e].run;
+    data = bcache[e].data;
+    restore_flags(flags);
+    return data;
+}
+
+/*
+ * fs_region_init
+ *   DESCRIPTION: Maps FS_REGION and copies the boot image into it. Every block
+ *                after the image's own data blocks becomes a (free) data block,
+ *                so files can grow. An image too big for the region, or a region
+ *                frame_init found no RAM for, stays where the boot loader put it.
+ *                Only its unused blocks among the first FS_MAX_BLOCKS (the ones
+ *                block_map covers) are then writable
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies page directory entries FS_REGION_PDE and up, may move
+ *                 boot_addr and grow boot_block.data_count
+ */
+static void fs_region_init(void) {
+    uint32_t image_blocks = 1 + boot_block.inode_count + boot_block.data_count;
+    uint32_t i;
+
+    /* No RAM there: the image stays in its module and cannot grow */
+    if(!frame_fs_region_ok)
+        return;
+
+    /* Attributes: global, page size, supervisor level, read/write, present
+     * Lowmem may already map the region identically, otherwise the entries
+     * were not present, so no stale translation can be cached either way
+     */
+    for(i = 0; i < FS_REGION_SIZE / FOUR_MB; i++)
+        page_directory[FS_REGION_PDE + i] = (FS_REGION + i * FOUR_MB) | 0x183;
+
+    if((image_blocks > FS_MAX_BLOCKS) || (boot_block.inode_count > FS_MAX_INODES))
+        return;
+
+    memcpy((void*) FS_REGION, (void*) boot_addr, image_blocks * BLOCK_SIZE);
+    boot_addr = FS_REGION;
+
+    boot_block.data_count = FS_MAX_BLOCKS - 1 - boot_block.inode_count;
+    memcpy((unsigned int*)(boot_addr + DATA_OFFSET), &boot_block.data_count, 4);
+}
+
+/*
+ * free_map_build
+ *   DESCRIPTION: Marks the data blocks and inodes of every regular file in use,
+ *                everything else is free, and fills in the metadata table
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Resets block_map[], alloc_blocks, inode_used[], the inode
+ *                 references, fmeta[] and fs_free_blocks
+ */
+static void free_map_build(void) {
+    uint32_t idx, b, num_blocks, block_num;
+    inode_t* node;
+
+    memset(block_map, 0, sizeof(block_map));
+    memset(inode_used, 0, sizeof(inode_used));
+    memset(inode_refs, 0, sizeof(inode_refs));
+    memset(inode_pins, 0, sizeof(inode_pins));
+    memset(inode_execs, 0, sizeof(inode_execs));
+    memset(inode_unlinked, 0, sizeof(inode_unlinked));
+    memset(fmeta, 0, sizeof(fmeta));
+    alloc_blocks = (boot_block.data_count < FS_MAX_BLOCKS) ? boot_block.data_count : FS_MAX_BLOCKS;
+    fs_free_blocks = alloc_blocks;
+    fs_blocks_written = 0;
+    alloc_cursor = 0;
+
+    /* Bits past the last data block never look free */
+    for(b = alloc_blocks; b < FS_MAX_BLOCKS; b++)
+        block_map[b / 32] |= (1 << (b % 32));
+
+    for(idx = 0; idx < boot_block.dir_count; idx++) {
+        if(((dentries+idx)->filetype != REG_FILE) || ((dentries+idx)->inode_num >= FS_MAX_INODES))
+            continue;
+
+        node = inodes + (dentries+idx)->inode_num;
+        inode_used[(dentries+idx)->inode_num] = 1;
+        fmeta_update((dentries+idx)->inode_num);
+
+        num_blocks = fmeta[(dentries+idx)->inode_num].blocks;
+        for(b = 0; b < num_blocks; b++) {
+            block_num = node->data_block_num[b];
+            if((block_num < alloc_blocks) && !(block_map[block_num / 32] & (1 << (block_num % 32)))) {
+                block_map[block_num / 32] |= (1 << (block_num % 32));
+                fs_free_blocks--;
+            }
+        }
+    }
+}
+
+/*
+ * block_alloc
+ *   DESCRIPTION: Takes a free data block, preferring hint so that a file being
+ *                appended to stays physically contiguous. Otherwise allocation
+ *                continues where the last one left off, filling the free space
+ *                front to back like a log
+ *   INPUTS: hint - preferred block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: block number, -1 if the file system is full
+ *   SIDE EFFECTS: Marks the block used
+ */
+static int32_t block_alloc(uint32_t hint) {
+    uint32_t b, words, w;
+
+    if(fs_free_blocks == 0)
+        return -1;
+
+    if((hint >= alloc_blocks) || (block_map[hint / 32] & (1 << (hint % 32)))) {
+        /* Skip whole words of used blocks */
+        words = (alloc_blocks + 31) / 32;
+        w = alloc_cursor / 32;
+        while(block_map[w] == 0xFFFFFFFF)
+            w = (w + 1) % words;
+
+        for(hint = w * 32; block_map[w] & (1 << (hint % 32)); hint++);
+        if(hint >= alloc_blocks)
+            return -1;
+    }
+
+    b = hint;
+    block_map[b / 32] |= (1 << (b % 32));
+    fs_free_blocks--;
+    alloc_cursor = (b + 1 < alloc_blocks) ? b + 1 : 0;
+
+    return b;
+}
+
+/* Returns a data block to the free map */
+static void block_free(uint32_t b) {
+    if((b < alloc_blocks) && (block_map[b / 32] & (1 << (b % 32)))) {
+        block_map[b / 32] &= ~(1 << (b % 32));
+        fs_free_blocks++;
+    }
+}
+
+/*
+ * bcache_invalidate
+ *   DESCRIPTION: Drops every cached block of an inode, raw or decompressed, needed
+ *                once its block list changes under existing entries (truncate, unlink)
+ *   INPUTS: inode - inode number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Unlinks entries from the hash chains, they stay in the LRU list
+ */
+static void bcache_invalidate(uint32_t inode) {
+    uint32_t flags;
+    int16_t* link;
+    int i;
+
+    cli_and_save(flags);
+
+    for(i = 0; i < DCACHE_SIZE; i++) {
+        if(dcache[i].inode == inode)
+            dcache[i].inode = BCACHE_EMPTY;
+    }
+
+    for(i = 0; i < BCACHE_BUCKETS; i++) {
+        link = &bcache_hash[i];
+        while(*link != BCACHE_EMPTY) {
+            if(bcache[*link].inode == inode) {
+                bcache[*link].inode = BCACHE_EMPTY;
+                *link = bcache[*link].hnext;
+            } else {
+                link = &bcache[*link].hnext;
+            }
+        }
+    }
+    restore_flags(flags);
+}
+
+/*
+ * fmeta_update
+ *   DESCRIPTION: Refreshes the metadata table entry of an inode from the inode block.
+ *                A compressed file occupies as many blocks as its stream needs; the
+ *                last entry of the offset table (always in the first block) is the
+ *                stream length
+ *   INPUTS: inode - inode number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies fmeta[inode]
+ */
+static void fmeta_update(uint32_t inode) {
+    inode_t* node = inodes + inode;
+    uint32_t entries, block_num;
+    uint32_t* table;
+
+    if(inode >= FS_MAX_INODES)
+        return;
+
+    fmeta[inode].flags = node->length & INODE_COMPRESSED;
+    fmeta[inode].size = node->length & ~INODE_COMPRESSED;
+    fmeta[inode].blocks = (fmeta[inode].size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    if(fmeta[inode].flags & INODE_COMPRESSED) {
+        entries = LZ_TABLE_ENTRIES(fmeta[inode].size);
+        block_num = node->data_block_num[0];
+        fmeta[inode].blocks = 0;
+
+        /* A broken table leaves the file with no readable blocks */
+        if((entries <= MAX_FILE_BLOCKS + 1) && (block_num < boot_block.data_count)) {
+            table = (uint32_t*) (data_blocks + block_num * BLOCK_SIZE);
+            if(table[entries - 1] <= MAX_FILE_BLOCKS * BLOCK_SIZE)
+                fmeta[inode].blocks = (table[entries - 1] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        }
+    }
+}
+
+/*
+ * fs_stat
+ *   DESCRIPTION: Fills in type, inode, size and block count of a file from its
+ *                dentry and the metadata table
+ *   INPUTS: dentry - dentry of the file
+ *   OUTPUTS: st - filled in
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t fs_stat(const dentry_t* dentry, stat_t* st) {
+    if((dentry == NULL) || (st == NULL))
+        return -1;
+
+    st->filetype = dentry->filetype;
+    st->inode_num = dentry->inode_num;
+    st->size = 0;
+    st->blocks = 0;
+
+    if((dentry->filetype == REG_FILE) && (dentry->inode_num < FS_MAX_INODES)) {
+        st->size = fmeta[dentry->inode_num].size;
+        st->blocks = fmeta[dentry->inode_num].blocks;
+    }
+
+    return 0;
 }
 
 /*
@@ -39,28 +565,44 @@ void fs_init(uint32_t boot) {
  *   SIDE EFFECTS: If succesful, modifies dentry block passed in
  */
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
+    uint32_t hash;
+    uint32_t slot;
+    uint32_t probe = 0;
     uint32_t idx;
-    int nameFound = 0;
 
     /* Piazza @864: bounds check */
     if(strlen((const int8_t*) fname) > FILENAME_LEN)
         return -1;
 
-    /* Find dentry index in boot block  */
-    for(idx = 0; idx < boot_block.dir_count; idx++) {
-        int8_t byte_size = (strlen((int8_t*)(dentries+idx)->filename) > strlen((const int8_t*) fname)) ?
-        strlen((int8_t*)(dentries+idx)->filename) : strlen((const int8_t*) fname);
-        byte_size = (byte_size > 32) ? 32 : byte_size;
-        if(strncmp((const int8_t*) fname, (int8_t*) (dentries+idx)->filename, byte_size) == 0) {
-            nameFound = 1;
+    /* Probe the name index until we hit the name or an empty slot */
+    hash = name_hash((const int8_t*) fname);
+    slot = hash & (NAME_INDEX_SIZE - 1);
+    while(name_index[slot] != 0) {
+        probe++;
+        idx = name_index[slot] - 1;
+        if((dentry_hash[idx] == hash) &&
+           (strncmp((const int8_t*) fname, (dentries+idx)->filename, FILENAME_LEN) == 0))
             break;
-        }
+        slot = (slot + 1) & (NAME_INDEX_SIZE - 1);
     }
 
-    if(nameFound)
-        return read_dentry_by_index(idx, dentry);
-    else
-        return -1;
+    name_lookups++;
+    name_probes += probe;
+    if(probe > name_max_probe)
+        name_max_probe = probe;
+
+    if(name_index[slot] != 0)
+        return read_dentry_by_index(name_index[slot] - 1, dentry);
+
+    /* Kernel-provided file that has no dentry in the boot block */
+    if(is_stats_file(fname)) {
+        memset(dentry, 0, sizeof(dentry_t));
+        strncpy(dentry->filename, (const int8_t*) fname, FILENAME_LEN);
+        dentry->filetype = STATS_FILE;
+        return 0;
+    }
+
+    return -1;
 }
 
 /*
@@ -86,72 +628,635 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
 
 
 /*
- * read_data
- *   DESCRIPTION: populates buffer (via memcpy) with data from data blocks which are taken from the inode struct
+ * dcache_block
+ *   DESCRIPTION: Returns one decompressed 4-kB block of a compressed file, from the
+ *                decompression cache or by decoding its LZ block into the next entry
+ *   INPUTS: inode - inode of a compressed file, block - block index in the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the decompressed data, NULL if the stream is corrupt
+ *   SIDE EFFECTS: May replace a dcache entry, caller keeps interrupts off until
+ *                 it is done with the returned data
+ */
+static uint8_t* dcache_block(uint32_t inode, uint32_t block) {
+    uint32_t size = fmeta[inode].size;
+    uint32_t stream_end = fmeta[inode].blocks * BLOCK_SIZE;
+    uint32_t start, end, chunk_length, block_length, copied, part;
+    dcache_entry_t* entry;
+    uint32_t* table;
+    uint8_t* src;
+    int i;
+
+    for(i = 0; i < DCACHE_SIZE; i++) {
+        if((dcache[i].inode == inode) && (dcache[i].block == block)) {
+            dcache_hits++;
+            return dcache[i].data;
+        }
+    }
+    dcache_misses++;
+
+    /* The offset table sits at the front of the first block */
+    table = (uint32_t*) fs_block(inode, 0);
+    if(table == NULL)
+        return NULL;
+    start = table[block];
+    end = table[block + 1];
+    block_length = (size - block * BLOCK_SIZE < BLOCK_SIZE) ? size - block * BLOCK_SIZE : BLOCK_SIZE;
+    if((start > end) || (end > stream_end) || (end - start > block_length))
+        return NULL;
+    chunk_length = end - start;
+
+    /* A chunk split across two data blocks is gathered into lz_in first */
+    if((chunk_length == 0) || (start / BLOCK_SIZE == (end - 1) / BLOCK_SIZE)) {
+        src = fs_block(inode, start / BLOCK_SIZE);
+        if(src == NULL)
+            return NULL;
+        src += start % BLOCK_SIZE;
+    } else {
+        for(copied = 0; copied < chunk_length; copied += part) {
+            src = fs_block(inode, (start + copied) / BLOCK_SIZE);
+            if(src == NULL)
+                return NULL;
+            part = BLOCK_SIZE - (start + copied) % BLOCK_SIZE;
+            if(part > chunk_length - copied)
+                part = chunk_length - copied;
+            memcpy(lz_in + copied, src + (start + copied) % BLOCK_SIZE, part);
+        }
+        src = lz_in;
+    }
+
+    entry = &dcache[dcache_next];
+    dcache_next = (dcache_next + 1) % DCACHE_SIZE;
+    entry->inode = BCACHE_EMPTY;
+
+    if(chunk_length == block_length)
+        memcpy(entry->data, src, block_length);
+    else if(lz_decompress(src, chunk_length, entry->data, block_length) == -1)
+        return NULL;
+
+    entry->inode = inode;
+    entry->block = block;
+    return entry->data;
+}
+
+/*
+ * read_compressed
+ *   DESCRIPTION: read_data for compressed files, copies out of decompressed blocks.
+ *                Interrupts stay off from the lookup to the copy out, like the
+ *                block cache: lz_in and a dcache entry are shared by every reader,
+ *                and a preempting reader could refill either one under us
+ *   INPUTS: inode, offset, buffer, length -- as read_data, already clamped to the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: length on success, -1 if the stream is corrupt
+ *   SIDE EFFECTS: May replace dcache entries
+ */
+static int32_t read_compressed(uint32_t inode, uint32_t offset, uint8_t* buffer, uint32_t length) {
+    uint32_t bytes_copied, copy_length, block_offset;
+    uint32_t flags;
+    uint8_t* block;
+
+    cli_and_save(flags);
+
+    for(bytes_copied = 0; bytes_copied < length; bytes_copied += copy_length) {
+        block = dcache_block(inode, (offset + bytes_copied) / BLOCK_SIZE);
+        if(block == NULL) {
+            restore_flags(flags);
+            return -1;
+        }
+
+        block_offset = (offset + bytes_copied) % BLOCK_SIZE;
+        copy_length = BLOCK_SIZE - block_offset;
+        if(copy_length > length - bytes_copied)
+            copy_length = length - bytes_copied;
+
+        memcpy(buffer + bytes_copied, block + block_offset, copy_length);
+    }
+
+    restore_flags(flags);
+    return length;
+}
+
+/*
+ * read_data_unlocked
+ *   DESCRIPTION: populates buffer (via memcpy) with data from data blocks which are taken from the inode struct.
+ *                Blocks that are physically contiguous in the image are copied with one memcpy per run
  *   INPUTS: uint32_t inode -- inode number to read from, uint32_t offset -- start reading from this offset, uint8_t* buffer -- buffer to fill, uint32_t length -- size of file
  *   OUTPUTS: none
  *   RETURN VALUE: length -- size of the file
  *   SIDE EFFECTS: none
  */
- int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buffer, uint32_t length) {
-     int idx;
-     int copy_length = BLOCK_SIZE - offset;  //1st block copy size
+ static int32_t read_data_unlocked(uint32_t inode, uint32_t offset, uint8_t* buffer, uint32_t length) {
      int data_idx = offset / BLOCK_SIZE;
-     uint32_t data_blocks = (uint32_t)(boot_addr + (boot_block.inode_count) * BLOCK_SIZE + BLOCK_SIZE);  //beginning of data blocks
+     int block_offset = offset % BLOCK_SIZE;     //only the first run starts mid-block
+     uint32_t run;
+     uint32_t copy_length;
+     uint32_t bytes_copied = 0;
+     uint8_t* block;
 
      //checks if inode & data block are both valid
      //inode check
-     if(inode >= boot_block.inode_count)   //check if current inode is less than max inodes
+     if((inode >= boot_block.inode_count) || (inode >= FS_MAX_INODES))   //check if current inode is less than max inodes
         return -1;
 
      //inode element stored in vars
-     int32_t file_length = (inodes + inode)->length;
+     int32_t file_length = fmeta[inode].size;
 
      if(offset >= file_length)           //check if offset param is past the length of file
         return -1;
 
-     if((length + offset) > file_length)
+     if(length > file_length - offset)   //clamp to the bytes left in the file (no overflow on huge lengths)
         length = file_length - offset;
 
-     //data check
-     if((inodes + inode)->data_block_num[data_idx] > boot_block.data_count)
+     if(fmeta[inode].flags & INODE_COMPRESSED)
+        return read_compressed(inode, offset, buffer, length);
+
+     while(bytes_copied < length) {
+         //data check (resolved through the block cache), run = contiguous blocks from here
+         block = fs_extent(inode, data_idx, &run);
+         if(block == NULL)
+            return -1;
+
+         //copy the whole run at once, or whatever is left to copy
+         copy_length = run * BLOCK_SIZE - block_offset;
+         if(copy_length > length - bytes_copied)
+            copy_length = length - bytes_copied;
+
+         memcpy(buffer, block + block_offset, copy_length);     //copy file data into a buffer
+         buffer += copy_length;                                  //update buffer, bytes copied, & block index
+         bytes_copied += copy_length;
+         data_idx += run;
+         block_offset = 0;
+         read_extents++;
+     }
+     return length;
+ }
+
+/*
+ * read_data
+ *   DESCRIPTION: read_data_unlocked with interrupts off, so a writer cannot change
+ *                the file's length or block list halfway through the read
+ *   INPUTS: inode, offset, buffer, length -- as read_data_unlocked
+ *   OUTPUTS: none
+ *   RETURN VALUE: as read_data_unlocked
+ *   SIDE EFFECTS: none
+ */
+int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buffer, uint32_t length) {
+    uint32_t flags;
+    int32_t ret;
+
+    cli_and_save(flags);
+    ret = read_data_unlocked(inode, offset, buffer, length);
+    restore_flags(flags);
+
+    return ret;
+}
+
+
+/*
+ * write_data_unlocked
+ *   DESCRIPTION: Writes length bytes at offset into a regular file, one block at a
+ *                time: each block is filled with a single memcpy and the inode
+ *                length is updated once at the end. Writing past the end of the file
+ *                zero fills the gap and appends new blocks, taken right after the
+ *                file's last block when that one is free
+ *   INPUTS: inode  - inode number of a regular file
+ *           offset - where to start writing
+ *           buffer - bytes to write (NULL only when length is 0)
+ *           length - number of bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes written (short if the file system fills up),
+ *                 -1 on failure or if a program without an image cache slot
+ *                 runs from the file
+ *   SIDE EFFECTS: May allocate data blocks, drops any cached program image of the file
+ */
+static int32_t write_data_unlocked(uint32_t inode, uint32_t offset, const uint8_t* buffer, uint32_t length) {
+    inode_t* node = inodes + inode;
+    uint32_t max_length = MAX_FILE_BLOCKS * BLOCK_SIZE;
+    uint32_t num_blocks, idx, block_offset, copy_length, pos, end;
+    int32_t block_num;
+    uint8_t* block;
+
+    if((inode >= boot_block.inode_count) || (inode >= FS_MAX_INODES) || !inode_used[inode])
+        return -1;
+
+    /* Compressed files are read-only until truncated to 0 */
+    if(fmeta[inode].flags & INODE_COMPRESSED)
+        return -1;
+
+    /* A program loading its pages from the file would mix old and new code */
+    if(inode_execs[inode] > 0)
+        return -1;
+
+    if(offset > max_length)
         return -1;
+    if(length > max_length - offset)
+        length = max_length - offset;
+
+    num_blocks = (node->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    end = offset + length;
+
+    /* Start at the old end of file if there is a gap to zero fill */
+    pos = (offset < node->length) ? offset : node->length;
+
+    /* Running programs keep their copy, new ones see the new contents */
+    if(pos < end)
+        image_cache_invalidate(inode);
+
+    while(pos < end) {
+        idx = pos / BLOCK_SIZE;
+        block_offset = pos % BLOCK_SIZE;
+
+        /* Append a block, contiguous with the previous one if possible */
+        if(idx >= num_blocks) {
+            block_num = block_alloc((num_blocks > 0) ? node->data_block_num[num_blocks - 1] + 1 : alloc_cursor);
+            if(block_num == -1)
+                break;
+            node->data_block_num[num_blocks++] = block_num;
+            memset(data_blocks + block_num * BLOCK_SIZE, 0, BLOCK_SIZE);
+        }
+        block = data_blocks + node->data_block_num[idx] * BLOCK_SIZE;
+
+        copy_length = BLOCK_SIZE - block_offset;
+        if(copy_length > end - pos)
+            copy_length = end - pos;
+
+        if(pos < offset) {
+            /* Gap between the old end of file and offset */
+            if(copy_length > offset - pos)
+                copy_length = offset - pos;
+            memset(block + block_offset, 0, copy_length);
+        } else {
+            memcpy(block + block_offset, buffer + (pos - offset), copy_length);
+        }
 
-     //set up data blocks to copy: data blocks beginning address plus data_idx of current inode * size of block plus offset
-     int copy_data = (data_blocks + ((inodes + inode)->data_block_num[data_idx]) * BLOCK_SIZE + offset % BLOCK_SIZE);
-     // copy_length = BLOCK_SIZE - offset;
-     copy_length = (copy_length > length) ? length : copy_length;      //if copy length is larger than length, set copy length equal to length; otherwise, if it's smaller, leave copy_length alone
-     copy_length = (copy_length <= 0) ? length : copy_length;          //if copy length is 0 or less, use length as copy size
+        pos += copy_length;
+        if(block_offset + copy_length == BLOCK_SIZE)
+            fs_blocks_written++;
+    }
+
+    if(pos > node->length)
+        node->length = pos;
+    fmeta_update(inode);
 
-     int bytes_copied = 0;
+    if(pos <= offset)
+        return (length == 0) ? 0 : -1;
 
-     uint8_t* og = buffer;
+    return pos - offset;
+}
 
-     for(idx = 0; idx < length; ){
-         if(buffer > (og+MAX_FILE_SIZE))
+/*
+ * write_data
+ *   DESCRIPTION: write_data_unlocked with interrupts off. File system updates
+ *                (free map, block lists, lengths, directory) are made one at a
+ *                time, and readers never see one half done
+ *   INPUTS: inode, offset, buffer, length -- as write_data_unlocked
+ *   OUTPUTS: none
+ *   RETURN VALUE: as write_data_unlocked
+ *   SIDE EFFECTS: as write_data_unlocked
+ */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buffer, uint32_t length) {
+    uint32_t flags;
+    int32_t ret;
+
+    cli_and_save(flags);
+    ret = write_data_unlocked(inode, offset, buffer, length);
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ * fs_truncate_unlocked
+ *   DESCRIPTION: Sets the length of a regular file. Shrinking frees the blocks
+ *                past the new end, growing zero fills. Truncating a compressed
+ *                file to 0 turns it into a plain empty file
+ *   INPUTS: inode  - inode number of a regular file
+ *           length - new length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure (a grow that runs out of space
+ *                 leaves the file unchanged) or if the file would shrink while
+ *                 it is mmapped or a program runs from it
+ *   SIDE EFFECTS: May free or allocate data blocks
+ */
+static int32_t fs_truncate_unlocked(uint32_t inode, uint32_t length) {
+    inode_t* node = inodes + inode;
+    uint32_t num_blocks, keep_blocks, old_length;
+
+    if((inode >= boot_block.inode_count) || (inode >= FS_MAX_INODES) || !inode_used[inode])
+        return -1;
+
+    /* Compressed files can only be emptied */
+    if((fmeta[inode].flags & INODE_COMPRESSED) && (length != 0))
+        return -1;
+
+    /* Mappings and running programs read the blocks in place */
+    if((length < node->length) && (inode_pins[inode] > 0))
+        return -1;
+
+    if(length > node->length) {
+        old_length = node->length;
+        num_blocks = fmeta[inode].blocks;
+
+        /* All or nothing: hand back the blocks of a grow that ran out of space */
+        if((write_data_unlocked(inode, length, NULL, 0) == -1) || (node->length != length)) {
+            keep_blocks = num_blocks;
+            num_blocks = (node->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            while(num_blocks > keep_blocks)
+                block_free(node->data_block_num[--num_blocks]);
+
+            node->length = old_length;
+            fmeta_update(inode);
+            return -1;
+        }
+        return 0;
+    }
+
+    image_cache_invalidate(inode);
+
+    num_blocks = fmeta[inode].blocks;
+    keep_blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    while(num_blocks > keep_blocks)
+        block_free(node->data_block_num[--num_blocks]);
+
+    node->length = length;
+    fmeta_update(inode);
+    bcache_invalidate(inode);
+
+    return 0;
+}
+
+/* fs_truncate_unlocked with interrupts off, see write_data */
+int32_t fs_truncate(uint32_t inode, uint32_t length) {
+    uint32_t flags;
+    int32_t ret;
+
+    cli_and_save(flags);
+    ret = fs_truncate_unlocked(inode, length);
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ * fs_create_unlocked
+ *   DESCRIPTION: Creates an empty regular file, or truncates an existing one
+ *   INPUTS: fname - name of the file (at most FILENAME_LEN characters)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: Adds a dentry at the end of the directory and takes a free inode
+ */
+static int32_t fs_create_unlocked(const uint8_t* fname) {
+    dentry_t new_dentry;
+    dentry_t* entry;
+    uint32_t len, inode;
+
+    if(fname == NULL)
+        return -1;
+    len = strlen((const int8_t*) fname);
+    if((len == 0) || (len > FILENAME_LEN))
+        return -1;
+
+    if(read_dentry_by_name(fname, &new_dentry) == 0) {
+        if(new_dentry.filetype != REG_FILE)
+            return -1;
+        return fs_truncate_unlocked(new_dentry.inode_num, 0);
+    }
+
+    if(boot_block.dir_count >= MAX_DENTRIES)
+        return -1;
+
+    for(inode = 0; (inode < boot_block.inode_count) && (inode < FS_MAX_INODES); inode++) {
+        if(!inode_used[inode])
             break;
+    }
+    if((inode >= boot_block.inode_count) || (inode >= FS_MAX_INODES))
+        return -1;
 
-         memcpy(buffer, (uint8_t*)copy_data, copy_length);   //copy file data into a buffer
-         buffer = buffer + copy_length;                      //update buffer, bytes copied, & index with new lengths
-         bytes_copied += copy_length;
-         idx += copy_length;
+    inode_used[inode] = 1;
+    (inodes + inode)->length = 0;
+    fmeta_update(inode);
+    bcache_invalidate(inode);
+    image_cache_invalidate(inode);
 
-         if((inodes + inode)->data_block_num[data_idx] > boot_block.data_count)
-            return -1;        //data check again
+    entry = dentries + boot_block.dir_count;
+    memset(entry, 0, sizeof(dentry_t));
+    strncpy(entry->filename, (const int8_t*) fname, FILENAME_LEN);
+    if(hashes_stored)
+        *(uint32_t*)entry->reserved = name_hash(entry->filename);
+    entry->filetype = REG_FILE;
+    entry->inode_num = inode;
 
-         data_idx++;     //continue to next data index
-         copy_data = (data_blocks + ((inodes + inode)->data_block_num[data_idx]) * BLOCK_SIZE);  //in inode param, interate through the data_block array and set equal to pointer
+    boot_block.dir_count++;
+    memcpy((unsigned int*) boot_addr, &boot_block.dir_count, 4);
+    name_index_build();
 
-         if(length - bytes_copied > BLOCK_SIZE)        //if the total length is bigger than one block, we only want to copy one data block worth
-            copy_length = BLOCK_SIZE;
-         else
-            copy_length = length - bytes_copied;        //otherwise if its smaller, we subtract the length from the number of bytes copied to get remaining number of bytes needed to copy
-         if(copy_length > BLOCK_SIZE)                  //don't want to copy more than block size
-            copy_length = BLOCK_SIZE;
-     }
-     return length;
- }
+    return 0;
+}
+
+/* fs_create_unlocked with interrupts off, see write_data */
+int32_t fs_create(const uint8_t* fname) {
+    uint32_t flags;
+    int32_t ret;
+
+    cli_and_save(flags);
+    ret = fs_create_unlocked(fname);
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ * dir_entry_removed
+ *   DESCRIPTION: Keeps every open directory at the same next name after the dentry
+ *                at idx was removed and the ones behind it moved up
+ *   INPUTS: idx - index the removed dentry had
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Moves directory positions past idx back by one
+ */
+static void dir_entry_removed(uint32_t idx) {
+    uint32_t pid, fd;
+    file_t* file;
+
+    for(pid = 0; pid < MAX_PIDS; pid++) {
+        if(pcb_arr[pid] == NULL)
+            continue;
+        for(fd = 0; fd < MAX_OPEN_FILES; fd++) {
+            file = pcb_arr[pid]->fd_arr[fd];
+            if((file != NULL) && (file->fops == (int32_t*) dir_fops) && (file->fpos > idx))
+                file->fpos--;
+        }
+    }
+}
+
+/*
+ * fs_unlink_unlocked
+ *   DESCRIPTION: Removes a regular file, freeing its blocks and inode, or once
+ *                the last open file, mmap or program using it is gone. Later
+ *                dentries move up one slot so directory order is kept
+ *   INPUTS: fname - name of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: Modifies the directory
+ */
+static int32_t fs_unlink_unlocked(const uint8_t* fname) {
+    dentry_t old_dentry;
+    uint32_t idx;
+
+    if((fname == NULL) || (read_dentry_by_name(fname, &old_dentry) == -1))
+        return -1;
+    if(old_dentry.filetype != REG_FILE)
+        return -1;
+
+    for(idx = 0; idx < boot_block.dir_count; idx++) {
+        if(strncmp((dentries+idx)->filename, old_dentry.filename, FILENAME_LEN) == 0)
+            break;
+    }
+    if(idx >= boot_block.dir_count)
+        return -1;
+
+    /* Files still open, mapped or running are freed by their last fs_inode_put */
+    if(inode_refs[old_dentry.inode_num] == 0) {
+        fs_truncate_unlocked(old_dentry.inode_num, 0);
+        inode_used[old_dentry.inode_num] = 0;
+    } else {
+        inode_unlinked[old_dentry.inode_num] = 1;
+    }
+
+    memmove(dentries + idx, dentries + idx + 1, (boot_block.dir_count - idx - 1) * sizeof(dentry_t));
+    boot_block.dir_count--;
+    memset(dentries + boot_block.dir_count, 0, sizeof(dentry_t));
+    memcpy((unsigned int*) boot_addr, &boot_block.dir_count, 4);
+    name_index_build();
+    dir_entry_removed(idx);
+
+    return 0;
+}
 
+/* fs_unlink_unlocked with interrupts off, see write_data */
+int32_t fs_unlink(const uint8_t* fname) {
+    uint32_t flags;
+    int32_t ret;
+
+    cli_and_save(flags);
+    ret = fs_unlink_unlocked(fname);
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ * fs_inode_get
+ *   DESCRIPTION: Takes a reference on an inode for an open file object, an mmap
+ *                or a running program image
+ *   INPUTS: inode - inode number
+ *           pin   - 1 if the user reads the data blocks in place (mmap, program
+ *                   image), the file cannot shrink while it is pinned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: An unlinked inode is not freed until the reference is dropped
+ */
+void fs_inode_get(uint32_t inode, int32_t pin) {
+    uint32_t flags;
+
+    if(inode >= FS_MAX_INODES)
+        return;
+
+    cli_and_save(flags);
+    inode_refs[inode]++;
+    if(pin)
+        inode_pins[inode]++;
+    restore_flags(flags);
+}
+
+/*
+ * fs_inode_put
+ *   DESCRIPTION: Drops a reference taken by fs_inode_get
+ *   INPUTS: inode - inode number
+ *           pin   - as given to fs_inode_get
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Frees the blocks and the inode of an unlinked file with the
+ *                 last reference
+ */
+void fs_inode_put(uint32_t inode, int32_t pin) {
+    uint32_t flags;
+
+    if(inode >= FS_MAX_INODES)
+        return;
+
+    cli_and_save(flags);
+    if(inode_refs[inode] > 0)
+        inode_refs[inode]--;
+    if(pin && (inode_pins[inode] > 0))
+        inode_pins[inode]--;
+
+    if((inode_refs[inode] == 0) && inode_unlinked[inode]) {
+        inode_unlinked[inode] = 0;
+        fs_truncate_unlocked(inode, 0);
+        inode_used[inode] = 0;
+    }
+    restore_flags(flags);
+}
+
+/*
+ * fs_exec_ref
+ *   DESCRIPTION: Counts a task that runs its image straight from the file, a
+ *                task with an image cache slot is not counted
+ *   INPUTS: pcb   - the task
+ *           delta - 1 when it starts running the image, -1 when it stops
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Updates inode_execs, which blocks writes to the file
+ */
+static void fs_exec_ref(pcb_t* pcb, int32_t delta) {
+    uint32_t flags;
+
+    if((pcb->image_slot != NO_IMAGE_SLOT) || (pcb->image_inode >= FS_MAX_INODES))
+        return;
+
+    cli_and_save(flags);
+    if(delta > 0)
+        inode_execs[pcb->image_inode]++;
+    else if(inode_execs[pcb->image_inode] > 0)
+        inode_execs[pcb->image_inode]--;
+    restore_flags(flags);
+}
+
+/*
+ * fs_task_get
+ *   DESCRIPTION: Takes the program image and mmap references of a forked task,
+ *                which inherited its parent's address space
+ *   INPUTS: pcb - the new task
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Pins the image and every mapped inode once more
+ */
+void fs_task_get(pcb_t* pcb) {
+    uint32_t i;
+
+    fs_inode_get(pcb->image_inode, 1);
+    fs_exec_ref(pcb, 1);
+    for(i = 0; i < pcb->mmap_files; i++)
+        fs_inode_get(pcb->mmap_inodes[i], 1);
+}
+
+/*
+ * fs_task_put
+ *   DESCRIPTION: Drops the program image and mmap references of a halting task
+ *   INPUTS: pcb - the task, its address space is going away
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: May free unlinked files, empties the task's mmap list
+ */
+void fs_task_put(pcb_t* pcb) {
+    uint32_t i;
+
+    fs_exec_ref(pcb, -1);
+    fs_inode_put(pcb->image_inode, 1);
+    for(i = 0; i < pcb->mmap_files; i++)
+        fs_inode_put(pcb->mmap_inodes[i], 1);
+    pcb->mmap_files = 0;
+}
 
 /*
  * file_open
@@ -159,7 +1264,8 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
  *   INPUTS: filename - Name of the file to be opened
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
- *   SIDE EFFECTS: If succesful, update fd_arr[fd] fields
+ *   SIDE EFFECTS: If succesful, update fd_arr[fd] fields and take a reference
+ *                 on the inode (see fs_inode_get)
  */
 int32_t file_open(const uint8_t* filename, int fd ) {
     pcb_t* pcb_ptr = get_pcb();
@@ -169,57 +1275,162 @@ int32_t file_open(const uint8_t* filename, int fd ) {
         return -1;
     }
     /* Set file object fields */
-    pcb_ptr->fd_arr[fd].inode_num = open_dentry.inode_num;
-    pcb_ptr->fd_arr[fd].fpos = 0;
-    pcb_ptr->fd_arr[fd].flags = USED;
+    pcb_ptr->fd_arr[fd]->inode_num = open_dentry.inode_num;
+    pcb_ptr->fd_arr[fd]->fpos = 0;
+    pcb_ptr->fd_arr[fd]->flags = USED;
+    fs_inode_get(open_dentry.inode_num, 0);
 
     return 0;
 }
 
 /*
  * file_close
- *   DESCRIPTION: Regular file closing implemented in do_close
- *   INPUTS:
+ *   DESCRIPTION: Regular file closing, do_close frees the file object afterwards
+ *   INPUTS: fd - file descriptor
  *   OUTPUTS: none
  *   RETURN VALUE: 0
- *   SIDE EFFECTS:
+ *   SIDE EFFECTS: Drops the file object's inode reference
  */
 int32_t file_close(int32_t fd) {
+    pcb_t* pcb_ptr = get_pcb();
+
+    fs_inode_put(pcb_ptr->fd_arr[fd]->inode_num, 0);
     return 0;
 }
 
 /*
  * file_read
- *   DESCRIPTION: Takes in char buffer with the file descriptor and the length of the file to print. Calls read_data to popluate the printed buffer and read_dentry_by_name
- *   INPUTS: char* buffer -- buffer to be populated, int32_t fd -- file descriptor to get position offset in file, int32_t length -- size of file to be printed
+ *   DESCRIPTION: Takes in char buffer with the file descriptor and the length of the file to print. Calls read_data to popluate the printed buffer
+ *                starting at the file position, and advances the position by exactly the bytes read
+ *   INPUTS: char* buffer -- buffer to be populated, int32_t fd -- file descriptor to get position offset in file, int32_t length -- number of bytes to read
  *   OUTPUTS: none
- *   RETURN VALUE: Number of bytes read -- success, 0 -- fpos beyond or at end of file
+ *   RETURN VALUE: Number of bytes read -- success, 0 -- fpos beyond or at end of file, -1 -- bad arguments
  *   SIDE EFFECTS: none
  */
 int32_t file_read(int32_t fd, void* buf, int32_t nbytes){
     int32_t bytesRead;
-    int32_t readUntil = nbytes;
+    uint32_t readUntil;
     uint32_t f_length;
     pcb_t* pcb_ptr = get_pcb();
 
+    if(nbytes < 0)
+        return -1;
+
     /* Check if file position is at or beyond the end of file */
-    f_length = (inodes + pcb_ptr->fd_arr[fd].inode_num)->length;
-    if(pcb_ptr->fd_arr[fd].fpos >= f_length)
+    f_length = fmeta[pcb_ptr->fd_arr[fd]->inode_num].size;
+    if(pcb_ptr->fd_arr[fd]->fpos >= f_length)
         return 0;
 
     /* Read to end of the file or the end of the buf (whichever ends sooner) */
-    if(f_length < nbytes)
-        readUntil = f_length;
+    readUntil = f_length - pcb_ptr->fd_arr[fd]->fpos;
+    if(nbytes < readUntil)
+        readUntil = nbytes;
 
-    bytesRead = read_data(pcb_ptr->fd_arr[fd].inode_num, pcb_ptr->fd_arr[fd].fpos, buf, readUntil);
-    pcb_ptr->fd_arr[fd].fpos += bytesRead;
+    bytesRead = read_data(pcb_ptr->fd_arr[fd]->inode_num, pcb_ptr->fd_arr[fd]->fpos, buf, readUntil);
+    if(bytesRead < 0)
+        return -1;
+    pcb_ptr->fd_arr[fd]->fpos += bytesRead;
 
     return bytesRead;
 }
 
-/* Read-only filesystem */
+/*
+ * fpos_seek
+ *   DESCRIPTION: Moves the position of an open file, shared by every seekable file type
+ *   INPUTS: fd     - file descriptor
+ *           offset - signed offset from the point picked by whence
+ *           whence - SEEK_SET (start), SEEK_CUR (position) or SEEK_END (end)
+ *           end    - end of the file, in the file's position units
+ *   OUTPUTS: none
+ *   RETURN VALUE: new position, -1 if whence is bad or the position would be negative
+ *   SIDE EFFECTS: Modifies the file position
+ */
+int32_t fpos_seek(int32_t fd, int32_t offset, int32_t whence, uint32_t end) {
+    pcb_t* pcb_ptr = get_pcb();
+    int32_t base;
+
+    if(whence == SEEK_SET)
+        base = 0;
+    else if(whence == SEEK_CUR)
+        base = pcb_ptr->fd_arr[fd]->fpos;
+    else if(whence == SEEK_END)
+        base = end;
+    else
+        return -1;
+
+    if((offset < 0) && (base + offset < 0))
+        return -1;
+
+    pcb_ptr->fd_arr[fd]->fpos = base + offset;
+    return pcb_ptr->fd_arr[fd]->fpos;
+}
+
+/*
+ * file_lseek
+ *   DESCRIPTION: Repositions a regular file, seeking past the end is allowed
+ *                (a later write zero fills the gap)
+ *   INPUTS: fd - file descriptor, offset - byte offset, whence - SEEK_SET/CUR/END
+ *   OUTPUTS: none
+ *   RETURN VALUE: new file position, -1 on failure
+ *   SIDE EFFECTS: Modifies the file position
+ */
+int32_t file_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    pcb_t* pcb_ptr = get_pcb();
+
+    return fpos_seek(fd, offset, whence, fmeta[pcb_ptr->fd_arr[fd]->inode_num].size);
+}
+
+/*
+ * file_pread
+ *   DESCRIPTION: Reads from a regular file at offset without using or moving the
+ *                file position
+ *   INPUTS: fd - file descriptor, buf - buffer to fill, nbytes - bytes to read,
+ *           offset - where to start reading
+ *   OUTPUTS: none
+ *   RETURN VALUE: Number of bytes read, 0 at or past the end of file, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t file_pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset) {
+    pcb_t* pcb_ptr = get_pcb();
+    uint32_t inode = pcb_ptr->fd_arr[fd]->inode_num;
+    uint32_t flags;
+    int32_t ret;
+
+    if((nbytes < 0) || (offset < 0))
+        return -1;
+
+    /* The end of file check and the read see the same length */
+    cli_and_save(flags);
+    if(offset >= fmeta[inode].size)
+        ret = 0;
+    else
+        ret = read_data_unlocked(inode, offset, buf, nbytes);
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ * file_write
+ *   DESCRIPTION: Writes buf into a regular file at the file position (see write_data)
+ *   INPUTS: fd - file descriptor, buf - bytes to write, nbytes - number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: Number of bytes written, -1 on failure
+ *   SIDE EFFECTS: Advances the file position by the bytes written
+ */
 int32_t file_write(int32_t fd, const void* buf, int32_t nbytes) {
-    return -1;
+    int32_t bytesWritten;
+    pcb_t* pcb_ptr = get_pcb();
+
+    if((buf == NULL) || (nbytes < 0))
+        return -1;
+
+    bytesWritten = write_data(pcb_ptr->fd_arr[fd]->inode_num, pcb_ptr->fd_arr[fd]->fpos, buf, nbytes);
+    if(bytesWritten < 0)
+        return -1;
+    pcb_ptr->fd_arr[fd]->fpos += bytesWritten;
+
+    return bytesWritten;
 }
 
 /*
@@ -239,8 +1450,8 @@ int32_t dir_open(const uint8_t* filename, int fd) {
         return -1;
 
      /* Set file object fields */
-    pcb_ptr->fd_arr[fd].inode_num = 0;
-    pcb_ptr->fd_arr[fd].flags = USED;
+    pcb_ptr->fd_arr[fd]->inode_num = 0;
+    pcb_ptr->fd_arr[fd]->flags = USED;
 
     return 0;
 
@@ -263,34 +1474,98 @@ int32_t dir_write(int32_t fd, const void* buf, int32_t nbytes) {
  *           buf - buffer to put filename in
  *        nbytes - length of filename
  *   OUTPUTS: nonex
- *   RETURN VALUE: 0 on success, -1 on failure
+ *   RETURN VALUE: number of bytes read on success, 0 at the end of the directory, -1 on failure
  *   SIDE EFFECTS: Modifies buf
  */
 int32_t dir_read(int32_t fd, void* buf, int32_t nbytes) {
     pcb_t * pcb_ptr = get_pcb();
-    int8_t tmp[FILENAME_LEN+1];
+    uint32_t flags;
+    int8_t* name;
+    int32_t len;
 
     /* Invalid fd/buf */
-    if((fd < 0) || (fd >= MAX_OPEN_FILES) || (buf == NULL))
+    if((fd < 0) || (fd >= MAX_OPEN_FILES) || (buf == NULL) || (nbytes < 0))
         return -1;
 
     /* Check if dir is open */
-    if(pcb_ptr->fd_arr[fd].flags == NOT_USED)
+    if(pcb_ptr->fd_arr[fd] == NULL)
         return -1;
 
+    /* The directory does not change under us (see fs_unlink) */
+    cli_and_save(flags);
+
     /* Check if file position is at or beyond the end of file */
-    if(pcb_ptr->fd_arr[fd].fpos >= boot_block.dir_count)
+    if(pcb_ptr->fd_arr[fd]->fpos >= boot_block.dir_count) {
+        restore_flags(flags);
         return 0;
+    }
+
+    /* Name length (not EOS terminated when it fills the dentry), cut to fit buf */
+    name = (dentries+pcb_ptr->fd_arr[fd]->fpos)->filename;
+    for(len = 0; (len < FILENAME_LEN) && (len < nbytes) && (name[len] != '\0'); len++);
 
     /* Read files name by name in directory */
-    strncpy(buf, (dentries+pcb_ptr->fd_arr[fd].fpos)->filename, nbytes);
-    pcb_ptr->fd_arr[fd].fpos++;
+    memcpy(buf, name, len);
+    if(len < nbytes)
+        ((int8_t*) buf)[len] = '\0';
+    pcb_ptr->fd_arr[fd]->fpos++;
+    restore_flags(flags);
+
+    return len;
+}
+
+/*
+ * dir_lseek
+ *   DESCRIPTION:  Repositions a directory, positions count dentries
+ *   INPUTS: fd - file descriptor, offset - dentry offset, whence - SEEK_SET/CUR/END
+ *   OUTPUTS: none
+ *   RETURN VALUE: new position, -1 on failure
+ *   SIDE EFFECTS: Modifies the directory position
+ */
+int32_t dir_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    return fpos_seek(fd, offset, whence, boot_block.dir_count);
+}
 
-    /* Find out how many bytes were read into the buffer */
-    strncpy(tmp,buf,FILENAME_LEN+1);
-    tmp[FILENAME_LEN] = '\0';
+/*
+ * dir_getdents
+ *   DESCRIPTION:  Batched directory read: fills buf with as many dirent_t records
+ *                 as fit, starting at the directory position
+ *   INPUTS: fd  - file descriptor of an open directory
+ *           buf - buffer to put records in
+ *        nbytes - size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes filled (a multiple of sizeof(dirent_t)),
+ *                 0 at the end of the directory, -1 on failure or if buf
+ *                 cannot hold a single record
+ *   SIDE EFFECTS: Modifies buf, advances the directory position
+ */
+int32_t dir_getdents(int32_t fd, void* buf, int32_t nbytes) {
+    pcb_t * pcb_ptr = get_pcb();
+    dirent_t* rec = (dirent_t*) buf;
+    dentry_t* entry;
+    int32_t count = 0;
+    uint32_t flags;
+
+    if((buf == NULL) || (nbytes < (int32_t) sizeof(dirent_t)))
+        return -1;
 
-    return strlen(tmp);
+    cli_and_save(flags);
+    while((pcb_ptr->fd_arr[fd]->fpos < boot_block.dir_count) &&
+          ((count + 1) * sizeof(dirent_t) <= nbytes)) {
+        entry = dentries + pcb_ptr->fd_arr[fd]->fpos;
+
+        memcpy(rec->filename, entry->filename, FILENAME_LEN);
+        rec->filetype = entry->filetype;
+        rec->inode_num = entry->inode_num;
+        rec->length = (entry->filetype == REG_FILE) ? fmeta[entry->inode_num].size : 0;
+
+        rec++;
+        count++;
+        pcb_ptr->fd_arr[fd]->fpos++;
+    }
+    restore_flags(flags);
+
+    return count * sizeof(dirent_t);
 }
 
 /*
@@ -321,26 +1596,35 @@ int32_t isExe(const uint8_t* filename) {
 
 /*
  * program_load
- *   DESCRIPTION:  Loads program image to memory and finds entry point of program
+ *   DESCRIPTION:  Finds entry point of program and records which file backs the
+ *                 program image. Pages of the image are mapped in on first touch
+ *                 by the page fault handler (see demand_load), shared with other
+ *                 processes running the same program through the image cache
  *   INPUTS: filename  - Name of executable file
+ *           pcb       - PCB of the process that will run the program
  *   OUTPUTS: none
  *   RETURN VALUE: address of entry point on success, -1 on failure
- *   SIDE EFFECTS:
+ *   SIDE EFFECTS: Sets image fields of the PCB, takes an image cache reference
+ *                 and pins the inode until the process halts. Without a cache
+ *                 slot the file also cannot be written until then
  */
-uint32_t program_load(const uint8_t* filename) {
+uint32_t program_load(const uint8_t* filename, pcb_t* pcb) {
     dentry_t Mydentry;
     uint8_t buffer[METADATA_SIZE];
 
     if(read_dentry_by_name(filename, &Mydentry) == -1)
         return -1;
 
-    int size = (inodes + Mydentry.inode_num)->length;
-
     /* Get program meta-data (entry-point and ELF bytes) */
     read_data(Mydentry.inode_num, 0, buffer, METADATA_SIZE);
 
-    /* Memcpy user image to 0x080840800 */
-    read_data(Mydentry.inode_num, 0,(uint8_t*) IMAGE_ADDR, size);
+    /* Image is loaded lazily to 0x08048000 */
+    pcb->image_inode = Mydentry.inode_num;
+    pcb->image_size = fmeta[Mydentry.inode_num].size;
+    pcb->pages_loaded = 0;
+    pcb->image_slot = image_cache_get(Mydentry.inode_num, pcb->image_size);
+    fs_inode_get(Mydentry.inode_num, 1);
+    fs_exec_ref(pcb, 1);
 
     /* shell entry address in hex file (little endian) = e8 82 04 08
      *                                                   24 25 26 27
@@ -8,20 +8,62 @@
 #include "types.h"
 #include "syscalls.h"
 #include "process.h"
+#include "lz.h"
 
 #define STATS_SIZE             64
 #define INODE_OFFSET            4
 #define DATA_OFFSET             8
 #define FILENAME_LEN           32
 #define BLOCK_SIZE           4096
-#define MAX_FILE_SIZE       36164
 #define METADATA_SIZE          30
 #define IMAGE_ADDR     0x08048000
 
+/* Name index (power of two, at least twice the max dentry count) */
+#define NAME_INDEX_SIZE       128
+#define FNV_OFFSET     2166136261u
+#define FNV_PRIME        16777619
+
+/* Images built with fstools/buildfs -H carry each name's FNV-1a hash in the
+ * first four reserved bytes of its dentry, flagged by this magic at the
+ * start of the boot block's reserved area
+ */
+#define HASH_OFFSET            12
+#define NAME_HASH_MAGIC 0x31485348
+
+/* Block cache (both powers of two) */
+#define BCACHE_SIZE            32
+#define BCACHE_BUCKETS         16
+#define BCACHE_EMPTY           -1
+
+/* Writable copy of the file system image (48-MB to 56-MB), identity mapped */
+#define FS_REGION      0x03000000
+#define FS_REGION_PDE          12
+#define FS_REGION_SIZE 0x00800000
+#define FS_MAX_BLOCKS  (FS_REGION_SIZE / BLOCK_SIZE)
+#define FS_MAX_INODES        1023
+#define MAX_DENTRIES           63
+#define MAX_FILE_BLOCKS      1023
+
+/* Compressed inodes have this bit set in their length. Their data blocks hold
+ * a table of LZ_TABLE_ENTRIES(size) stream offsets, then one LZ block per 4-kB
+ * of file (a block as long as its uncompressed data is stored raw)
+ */
+#define INODE_COMPRESSED  0x40000000
+#define LZ_TABLE_ENTRIES(size)  (((size) + BLOCK_SIZE - 1) / BLOCK_SIZE + 1)
+
+/* Decompressed blocks kept around for sequential reads */
+#define DCACHE_SIZE             4
+
+/* lseek whence values */
+#define SEEK_SET        0
+#define SEEK_CUR        1
+#define SEEK_END        2
+
 /* File types */
 #define RTC_FILE        0
 #define DIR_FILE        1
 #define REG_FILE        2
+#define STATS_FILE      3
 
 /* From lecture notes -- Lecture 16 pg 26 */
 typedef struct directory_entry{
@@ -31,6 +73,41 @@ typedef struct directory_entry{
     int8_t reserved[24];
 } dentry_t;
 
+/* One record of a batched directory read (getdents), names are not EOS
+ * terminated when they are FILENAME_LEN long. length is 0 unless REG_FILE
+ */
+typedef struct dirent {
+    int8_t filename[FILENAME_LEN];
+    int32_t filetype;
+    int32_t inode_num;
+    int32_t length;
+} dirent_t;
+
+/* Returned by stat/fstat, size and blocks are 0 unless REG_FILE */
+typedef struct stat {
+    int32_t filetype;
+    int32_t inode_num;
+    uint32_t size;
+    uint32_t blocks;
+} stat_t;
+
+/* Metadata table entry, one per inode, kept in sync by the write path
+ * size is the file size, blocks the data blocks it occupies (fewer than
+ * the size needs when flags has INODE_COMPRESSED)
+ */
+typedef struct fmeta {
+    uint32_t size;
+    uint32_t blocks;
+    uint32_t flags;
+} fmeta_t;
+
+/* One decompressed block of a compressed file */
+typedef struct dcache_entry {
+    int32_t inode;
+    uint32_t block;
+    uint8_t data[BLOCK_SIZE];
+} dcache_entry_t;
+
 typedef struct boot_block {
     int32_t dir_count;
     int32_t inode_count;
@@ -44,10 +121,43 @@ typedef struct inode{
     int32_t data_block_num [1023];
 } inode_t;
 
+/* Resolved (inode, block index) -> block pointer, kept in LRU order
+ * run is the extent hint: how many blocks starting here are physically contiguous
+ */
+typedef struct bcache_entry {
+    int32_t inode;
+    uint32_t block;
+    uint8_t* data;
+    uint32_t run;
+    int16_t prev;
+    int16_t next;
+    int16_t hnext;
+} bcache_entry_t;
+
 extern uint32_t boot_addr;
 extern boot_t boot_block;
 extern dentry_t* dentries;
 extern inode_t* inodes;
+extern fmeta_t fmeta[FS_MAX_INODES];
+
+/* Name index counters: total lookups, total slots probed, longest probe */
+extern uint32_t name_lookups;
+extern uint32_t name_probes;
+extern uint32_t name_max_probe;
+
+/* Block cache counters */
+extern uint32_t bcache_hits;
+extern uint32_t bcache_misses;
+/* Bulk copies made by read_data, one per contiguous run */
+extern uint32_t read_extents;
+
+/* Decompression cache counters */
+extern uint32_t dcache_hits;
+extern uint32_t dcache_misses;
+
+/* Free data blocks left, and data blocks filled by writes */
+extern uint32_t fs_free_blocks;
+extern uint32_t fs_blocks_written;
 
 /* File System Utilities */
 
@@ -59,18 +169,35 @@ extern int32_t file_open(const uint8_t* filename, int fd );
 extern int32_t file_close(int32_t fd);
 extern int32_t file_write(int32_t fd, const void* buf, int32_t nbytes);
 extern int32_t file_read(int32_t fd, void* buf, int32_t nbytes);
+extern int32_t file_lseek(int32_t fd, int32_t offset, int32_t whence);
+extern int32_t file_pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset);
 
 /* Directory Functions */
 extern int32_t dir_open(const uint8_t* filename, int fd);
 extern int32_t dir_close(int32_t fd);
 extern int32_t dir_write(int32_t fd, const void* buf, int32_t nbytes);
 extern int32_t dir_read(int32_t fd, void* buf, int32_t nbytes);
+extern int32_t dir_getdents(int32_t fd, void* buf, int32_t nbytes);
+extern int32_t dir_lseek(int32_t fd, int32_t offset, int32_t whence);
 
 /* Helper functions */
+struct pcb;
 extern int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 extern int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 extern int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buffer, uint32_t length);
+extern uint8_t* fs_block(uint32_t inode, uint32_t block);
+extern uint8_t* fs_extent(uint32_t inode, uint32_t block, uint32_t* run);
+extern int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buffer, uint32_t length);
+extern int32_t fs_truncate(uint32_t inode, uint32_t length);
+extern int32_t fs_create(const uint8_t* fname);
+extern int32_t fs_unlink(const uint8_t* fname);
+extern int32_t fs_stat(const dentry_t* dentry, stat_t* st);
+extern void fs_inode_get(uint32_t inode, int32_t pin);
+extern void fs_inode_put(uint32_t inode, int32_t pin);
+extern void fs_task_get(struct pcb* pcb);
+extern void fs_task_put(struct pcb* pcb);
+extern int32_t fpos_seek(int32_t fd, int32_t offset, int32_t whence, uint32_t end);
 int32_t isExe(const uint8_t* filename);
-uint32_t program_load(const uint8_t* filename);
+uint32_t program_load(const uint8_t* filename, struct pcb* pcb);
 
 #endif
@@ -0,0 +1,207 @@
+#include "fpu.h"
+
+uint32_t fpu_traps;
+uint32_t fpu_loads;
+
+/* Task whose state is in the FPU registers, NULL if none. Its saved copy
+ * in fpu_state is stale until someone else takes the FPU
+ */
+static pcb_t* fpu_owner;
+/* 1 if the processor has fxsave/fxrstor (and SSE state), fnsave/frstor otherwise */
+static uint32_t fpu_fxsr;
+static uint32_t fpu_sse;
+/* Mirror of CR0.TS, a switch between tasks not using the FPU writes no CR0 */
+static uint32_t fpu_ts;
+
+static kmem_cache_t fpu_cache;
+
+/*
+ * fpu_set_ts
+ *   DESCRIPTION: Sets or clears CR0.TS, unless it already has that value
+ *   INPUTS: ts - 1 to make the next FPU instruction trap, 0 to let it run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Writes CR0
+ */
+static void fpu_set_ts(uint32_t ts) {
+    uint32_t cr0;
+
+    if(ts == fpu_ts)
+        return;
+    if(ts)
+        asm volatile("movl %%cr0, %0; orl %1, %0; movl %0, %%cr0" : "=&r"(cr0) : "i"(CR0_TS) : "memory");
+    else
+        asm volatile("clts" : : : "memory");
+    fpu_ts = ts;
+}
+
+/*
+ * fpu_save
+ *   DESCRIPTION: Stores the FPU registers (fnsave also reinitializes them)
+ *   INPUTS: state - FPU_STATE_SIZE bytes, 16-byte aligned
+ *   OUTPUTS: the register state in state
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void fpu_save(void* state) {
+    if(fpu_fxsr)
+        asm volatile("fxsave (%0)" : : "r"(state) : "memory");
+    else
+        asm volatile("fnsave (%0)" : : "r"(state) : "memory");
+}
+
+/*
+ * fpu_restore
+ *   DESCRIPTION: Loads the FPU registers stored by fpu_save
+ *   INPUTS: state - saved state
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void fpu_restore(void* state) {
+    if(fpu_fxsr)
+        asm volatile("fxrstor (%0)" : : "r"(state) : "memory");
+    else
+        asm volatile("frstor (%0)" : : "r"(state) : "memory");
+}
+
+/*
+ * fpu_init
+ *   DESCRIPTION: Enables the FPU, and fxsave/SSE when the processor has them,
+ *                with CR0.TS set so that the first FPU instruction of any task
+ *                traps into fpu_trap. Unmasked SSE exceptions are left to raise
+ *                #UD (CR4.OSXMMEXCPT clear, there is no #XM handler)
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Writes CR0 and CR4, registers the fpu cache and counters
+ */
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx, cr0, cr4;
+
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    fpu_fxsr = ((edx & CPUID_FXSR) != 0);
+    fpu_sse = (fpu_fxsr && ((edx & CPUID_SSE) != 0));
+
+    if(fpu_fxsr) {
+        asm volatile("movl %%cr4, %0" : "=r"(cr4));
+        asm volatile("movl %0, %%cr4" : : "r"(cr4 | CR4_OSFXSR));
+    }
+
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS;
+    asm volatile("movl %0, %%cr0" : : "r"(cr0) : "memory");
+    fpu_ts = 1;
+    fpu_owner = NULL;
+
+    fpu_traps = 0;
+    fpu_loads = 0;
+    kmem_cache_init(&fpu_cache, "fpu", FPU_STATE_SIZE);
+    stats_register("fpu_traps", &fpu_traps);
+    stats_register("fpu_loads", &fpu_loads);
+}
+
+/*
+ * fpu_switch
+ *   DESCRIPTION: Called by the scheduler before switching to a task. Only the
+ *                owner may use the FPU registers as they are, everyone else
+ *                traps on its first FPU instruction
+ *   INPUTS: next - task about to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: May write CR0
+ */
+void fpu_switch(pcb_t* next) {
+    fpu_set_ts(next != fpu_owner);
+}
+
+/*
+ * fpu_trap
+ *   DESCRIPTION: Device-not-available (#NM) handler. Saves the owner's FPU
+ *                state and loads the current task's, a task using the FPU for
+ *                the first time gets a freshly initialized one
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the faulting instruction can be restarted, -1 if the
+ *                 state could not be allocated
+ *   SIDE EFFECTS: Runs with interrupts off (interrupt gate), clears CR0.TS
+ */
+int32_t fpu_trap(void) {
+    pcb_t* cur_task = get_pcb();
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    int32_t fresh = 0;
+
+    fpu_traps++;
+    if(fpu_owner == cur_task) {
+        fpu_set_ts(0);
+        return 0;
+    }
+
+    if(cur_task->fpu_state == NULL) {
+        if((cur_task->fpu_state = kmem_cache_alloc(&fpu_cache)) == NULL)
+            return -1;
+        fresh = 1;
+    }
+
+    fpu_set_ts(0);
+    if(fpu_owner != NULL)
+        fpu_save(fpu_owner->fpu_state);
+    if(fresh) {
+        asm volatile("fninit");
+        if(fpu_sse)
+            asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    } else {
+        fpu_restore(cur_task->fpu_state);
+    }
+
+    fpu_owner = cur_task;
+    fpu_loads++;
+    return 0;
+}
+
+/*
+ * fpu_fork
+ *   DESCRIPTION: Gives a forked child the parent's FPU state as of the fork
+ *   INPUTS: parent - the running task
+ *           child  - its new copy, fpu_state NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the state could not be allocated
+ *   SIDE EFFECTS: The child traps and loads its copy on its first FPU use
+ */
+int32_t fpu_fork(pcb_t* parent, pcb_t* child) {
+    if(parent->fpu_state == NULL)
+        return 0;
+    if((child->fpu_state = kmem_cache_alloc(&fpu_cache)) == NULL)
+        return -1;
+
+    if(fpu_owner == parent) {
+        /* The live registers are newer than the parent's saved copy */
+        fpu_set_ts(0);
+        fpu_save(child->fpu_state);
+        if(!fpu_fxsr)
+            fpu_restore(child->fpu_state);
+    } else {
+        memcpy(child->fpu_state, parent->fpu_state, FPU_STATE_SIZE);
+    }
+    return 0;
+}
+
+/*
+ * fpu_release
+ *   DESCRIPTION: Frees a task's FPU state, for a halting or freed task
+ *   INPUTS: pcb - task giving up the FPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: If the task is running, its next FPU use traps again and
+ *                 starts from a fresh state
+ */
+void fpu_release(pcb_t* pcb) {
+    if(fpu_owner == pcb) {
+        fpu_owner = NULL;
+        if(pcb == get_pcb())
+            fpu_set_ts(1);
+    }
+
+    kmem_cache_free(&fpu_cache, pcb->fpu_state);
+    pcb->fpu_state = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+#include "lib.h"
+#include "syscalls.h"
+
+/* fxsave area (fnsave needs 108 bytes of it), 16-byte aligned by coming
+ * from its own cache of 512-byte objects
+ */
+#define FPU_STATE_SIZE      512
+
+#define CR0_MP              0x00000002  /* wait/fwait trap too while TS is set */
+#define CR0_EM              0x00000004  /* emulate the FPU, clear: there is one */
+#define CR0_TS              0x00000008  /* task switched, next FPU use traps (#NM) */
+#define CR0_NE              0x00000020  /* report FPU errors as #MF */
+#define CR4_OSFXSR          0x00000200  /* fxsave/fxrstor and SSE enabled */
+#define CR4_OSXMMEXCPT      0x00000400  /* SSE errors as #XM */
+
+#define CPUID_FXSR          0x01000000  /* edx of leaf 1 */
+#define CPUID_SSE           0x02000000
+#define MXCSR_DEFAULT       0x1F80      /* all SSE exceptions masked */
+
+extern uint32_t fpu_traps;      //#NM traps taken
+extern uint32_t fpu_loads;      //states loaded into the FPU
+
+/* Turns on the FPU (and SSE if present), every task's first use traps */
+extern void fpu_init(void);
+/* Called on a switch to next, sets CR0.TS unless next owns the FPU state */
+extern void fpu_switch(struct pcb* next);
+/* #NM handler, hands the FPU to the current task, -1 if that failed */
+extern int32_t fpu_trap(void);
+/* Gives the child of a fork a copy of the parent's FPU state, 0 on success */
+extern int32_t fpu_fork(struct pcb* parent, struct pcb* child);
+/* Frees a task's FPU state, the task must not use the FPU afterwards */
+extern void fpu_release(struct pcb* pcb);
+
+#endif
@@ -0,0 +1,311 @@
+#include "frame.h"
+#include "imgcache.h"
+#include "filesys.h"
+#include "stats.h"
+
+#define FULL_WORD   0xFFFFFFFF
+
+/* One bit per 4-kB frame of low memory, set when the frame is in use */
+static uint32_t frame_bitmap[FRAME_BITMAP_WORDS];
+/* Bitmap word frame_alloc starts searching from */
+static uint32_t frame_cursor;
+/* Extra owners of each frame (copy-on-write pages shared after fork), 0 for a single owner */
+static uint16_t frame_refs[MAX_FRAMES];
+
+uint32_t frame_mem_top;
+uint32_t frames_total;
+uint32_t frames_free;
+uint32_t frame_image_slots;
+int32_t frame_fs_region_ok;
+
+/* Bitmap helpers, frame is an index into frame_bitmap */
+static inline int32_t frame_used(uint32_t frame) {
+    return (frame_bitmap[frame / 32] >> (frame % 32)) & 1;
+}
+
+static inline void frame_set(uint32_t frame) {
+    frame_bitmap[frame / 32] |= 1 << (frame % 32);
+}
+
+static inline void frame_clear(uint32_t frame) {
+    frame_bitmap[frame / 32] &= ~(1 << (frame % 32));
+}
+
+/*
+ * frame_range
+ *   DESCRIPTION: Marks the frames of a physical range [start, end) within low
+ *                memory free or in use. Free ranges only cover whole frames,
+ *                reserved ranges cover every frame they touch
+ *   INPUTS: start - first byte of the range
+ *           end   - first byte past the range
+ *           used  - 1 to reserve the range, 0 to free it
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies frame_bitmap
+ */
+static void frame_range(uint32_t start, uint32_t end, int32_t used) {
+    uint32_t frame;
+
+    if(used) {
+        start &= ~(FOUR_KB - 1);
+        end = (end > FULL_WORD - FOUR_KB) ? FULL_WORD : (end + FOUR_KB - 1) & ~(FOUR_KB - 1);
+    } else {
+        start = (start > FULL_WORD - FOUR_KB) ? FULL_WORD : (start + FOUR_KB - 1) & ~(FOUR_KB - 1);
+        end &= ~(FOUR_KB - 1);
+    }
+
+    if(start < LOWMEM_START)
+        start = LOWMEM_START;
+    if(end > LOWMEM_END)
+        end = LOWMEM_END;
+
+    for(frame = start / FOUR_KB; frame < end / FOUR_KB; frame++) {
+        if(used)
+            frame_set(frame);
+        else
+            frame_clear(frame);
+    }
+
+    if(!used && (end > frame_mem_top))
+        frame_mem_top = end;
+}
+
+/*
+ * frame_range_usable
+ *   DESCRIPTION: Checks that a fixed region is wholly RAM the memory map freed
+ *                and that no boot module sits in it
+ *   INPUTS: mbi   - multiboot info passed in by the boot loader
+ *           start - first byte of the region (frame aligned)
+ *           end   - first byte past the region (frame aligned)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the region can be used, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int32_t frame_range_usable(multiboot_info_t* mbi, uint32_t start, uint32_t end) {
+    module_t* mod;
+    uint32_t frame, i;
+
+    for(frame = start / FOUR_KB; frame < end / FOUR_KB; frame++) {
+        if(frame_used(frame))
+            return 0;
+    }
+
+    if(mbi->flags & MB_FLAG_MODS) {
+        mod = (module_t*) mbi->mods_addr;
+        for(i = 0; i < mbi->mods_count; i++, mod++) {
+            if((mod->mod_start < end) && (mod->mod_end > start))
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * frame_init
+ *   DESCRIPTION: Frees every frame of low memory the multiboot memory map
+ *                reports as usable RAM (or mem_upper when there is no map),
+ *                then takes out the fixed regions: the image cache slots and
+ *                the file system region that are backed by RAM, and the boot
+ *                modules
+ *   INPUTS: mbi - multiboot info passed in by the boot loader
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Builds frame_bitmap, sets frame_mem_top, the frame counters,
+ *                 frame_image_slots and frame_fs_region_ok, called before
+ *                 paging is enabled
+ */
+void frame_init(multiboot_info_t* mbi) {
+    memory_map_t* mmap;
+    module_t* mod;
+    uint32_t i, end;
+
+    /* Everything starts out in use, only RAM is freed */
+    for(i = 0; i < FRAME_BITMAP_WORDS; i++)
+        frame_bitmap[i] = FULL_WORD;
+    frame_mem_top = 0;
+
+    if(mbi->flags & MB_FLAG_MMAP) {
+        for(mmap = (memory_map_t*) mbi->mmap_addr;
+            (uint32_t) mmap < mbi->mmap_addr + mbi->mmap_length;
+            mmap = (memory_map_t*) ((uint32_t) mmap + mmap->size + sizeof(mmap->size))) {
+            /* Only the low 4-GB can be mapped */
+            if((mmap->type != MMAP_AVAILABLE) || (mmap->base_addr_high != 0))
+                continue;
+            end = mmap->base_addr_low + mmap->length_low;
+            if((mmap->length_high != 0) || (end < mmap->base_addr_low))
+                end = FULL_WORD;
+            frame_range(mmap->base_addr_low, end, 0);
+        }
+    } else if(mbi->flags & MB_FLAG_MEMORY) {
+        /* mem_upper is the RAM in kB above 1-MB */
+        frame_range(ONE_MB, ONE_MB + mbi->mem_upper * 1024, 0);
+    }
+
+    /* Fixed regions with their own page directory entries, only where the
+     * machine has RAM: a missing image cache slot stays unused, a missing
+     * file system region leaves the image in its module
+     */
+    frame_image_slots = 0;
+    for(i = 0; i < IMAGE_CACHE_SLOTS; i++) {
+        end = IMAGE_CACHE_BASE + (i + 1) * FOUR_MB;
+        if(frame_range_usable(mbi, end - FOUR_MB, end)) {
+            frame_range(end - FOUR_MB, end, 1);
+            frame_image_slots |= 1 << i;
+        }
+    }
+    frame_fs_region_ok = frame_range_usable(mbi, FS_REGION, FS_REGION + FS_REGION_SIZE);
+    if(frame_fs_region_ok)
+        frame_range(FS_REGION, FS_REGION + FS_REGION_SIZE, 1);
+
+    /* The file system image is still in its module until fs_init copies it */
+    if(mbi->flags & MB_FLAG_MODS) {
+        mod = (module_t*) mbi->mods_addr;
+        for(i = 0; i < mbi->mods_count; i++, mod++)
+            frame_range(mod->mod_start, mod->mod_end, 1);
+    }
+
+    frame_mem_top = (frame_mem_top + FOUR_MB - 1) & ~(FOUR_MB - 1);
+
+    frames_free = 0;
+    for(i = LOWMEM_START / FOUR_KB; i < MAX_FRAMES; i++) {
+        if(!frame_used(i))
+            frames_free++;
+    }
+    frames_total = frames_free;
+    frame_cursor = 0;
+
+    stats_register("frames_total", &frames_total);
+    stats_register("frames_free", &frames_free);
+}
+
+/*
+ * frame_alloc
+ *   DESCRIPTION: Takes the first free frame at or after the search cursor
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the frame (identity mapped), NO_FRAME if
+ *                 memory is exhausted
+ *   SIDE EFFECTS: Marks the frame in use, moves the cursor. The frame is not zeroed
+ */
+uint32_t frame_alloc(void) {
+    uint32_t i, word, bit;
+
+    for(i = 0; i < FRAME_BITMAP_WORDS; i++) {
+        word = (frame_cursor + i) % FRAME_BITMAP_WORDS;
+        if(frame_bitmap[word] == FULL_WORD)
+            continue;
+
+        for(bit = 0; frame_bitmap[word] & (1 << bit); bit++) {}
+        frame_bitmap[word] |= 1 << bit;
+        frame_cursor = word;
+        frames_free--;
+        return (word * 32 + bit) * FOUR_KB;
+    }
+
+    return NO_FRAME;
+}
+
+/*
+ * frame_alloc_run
+ *   DESCRIPTION: Takes count contiguous free frames starting at a multiple of count
+ *   INPUTS: count - number of frames, a power of two
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the first frame, NO_FRAME if there is no
+ *                 such run (or count is not a power of two)
+ *   SIDE EFFECTS: Marks the frames in use. They are not zeroed
+ */
+uint32_t frame_alloc_run(uint32_t count) {
+    uint32_t frame, i;
+
+    if(count == 1)
+        return frame_alloc();
+    if((count == 0) || (count & (count - 1)) || (count > MAX_FRAMES))
+        return NO_FRAME;
+
+    for(frame = LOWMEM_START / FOUR_KB; frame < MAX_FRAMES; frame += count) {
+        for(i = 0; (i < count) && !frame_used(frame + i); i++) {}
+        if(i < count)
+            continue;
+
+        for(i = 0; i < count; i++)
+            frame_set(frame + i);
+        frames_free -= count;
+        return frame * FOUR_KB;
+    }
+
+    return NO_FRAME;
+}
+
+/*
+ * frame_free
+ *   DESCRIPTION: Drops one owner of a frame and returns the frame to the
+ *                allocator when it was the last one
+ *   INPUTS: addr - physical address returned by frame_alloc
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Clears the frame's bit, pulls the cursor back to it.
+ *                 Addresses outside low memory and free frames are ignored
+ */
+void frame_free(uint32_t addr) {
+    uint32_t frame = addr / FOUR_KB;
+
+    if((addr < LOWMEM_START) || (addr >= LOWMEM_END) || !frame_used(frame))
+        return;
+
+    if(frame_refs[frame] > 0) {
+        frame_refs[frame]--;
+        return;
+    }
+
+    frame_clear(frame);
+    frames_free++;
+    if(frame / 32 < frame_cursor)
+        frame_cursor = frame / 32;
+}
+
+/*
+ * frame_free_run
+ *   DESCRIPTION: Returns a run of frames from frame_alloc_run to the allocator
+ *   INPUTS: addr  - physical address of the first frame
+ *           count - number of frames in the run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: See frame_free
+ */
+void frame_free_run(uint32_t addr, uint32_t count) {
+    uint32_t i;
+
+    for(i = 0; i < count; i++)
+        frame_free(addr + i * FOUR_KB);
+}
+
+/*
+ * frame_share
+ *   DESCRIPTION: Adds an owner to a frame in use, each owner gives it back
+ *                with its own frame_free
+ *   INPUTS: addr - physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Increments the frame's owner count
+ */
+void frame_share(uint32_t addr) {
+    uint32_t frame = addr / FOUR_KB;
+
+    if((addr >= LOWMEM_START) && (addr < LOWMEM_END) && frame_used(frame))
+        frame_refs[frame]++;
+}
+
+/*
+ * frame_shared
+ *   DESCRIPTION: Checks whether a frame has more than one owner
+ *   INPUTS: addr - physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if shared, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t frame_shared(uint32_t addr) {
+    if((addr < LOWMEM_START) || (addr >= LOWMEM_END))
+        return 0;
+    return frame_refs[addr / FOUR_KB] > 0;
+}
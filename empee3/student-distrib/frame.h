@@ -0,0 +1,53 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "types.h"
+#include "lib.h"
+#include "multiboot.h"
+#include "paging.h"
+
+/* Physical frames handed out to processes: free RAM from 8-MB up to the
+ * user page at 128-MB, identity mapped for the kernel with 4-MB pages.
+ * RAM above that is not reachable by the kernel and is left alone.
+ */
+#define LOWMEM_START        FIRST_USER
+#define LOWMEM_END          USER_PAGE_START
+#define MAX_FRAMES          (LOWMEM_END / FOUR_KB)
+#define FRAME_BITMAP_WORDS  (MAX_FRAMES / 32)
+#define NO_FRAME            0
+
+/* Kernel stacks are 8-kB aligned so get_pcb can find the PCB at the bottom */
+#define KSTACK_FRAMES       (EIGHT_KB / FOUR_KB)
+
+/* multiboot info flags and the memory map type of usable RAM */
+#define MB_FLAG_MEMORY      0x01
+#define MB_FLAG_MODS        0x08
+#define MB_FLAG_MMAP        0x40
+#define MMAP_AVAILABLE      1
+#define ONE_MB              0x00100000
+
+/* Builds the free frame bitmap from the multiboot memory map */
+extern void frame_init(multiboot_info_t* mbi);
+/* Returns the physical address of a free 4-kB frame, or NO_FRAME */
+extern uint32_t frame_alloc(void);
+/* Returns count (a power of two) contiguous frames aligned to their size, or NO_FRAME */
+extern uint32_t frame_alloc_run(uint32_t count);
+/* Gives back frames from frame_alloc/frame_alloc_run */
+extern void frame_free(uint32_t addr);
+extern void frame_free_run(uint32_t addr, uint32_t count);
+/* Adds an owner to a frame (copy on write), frame_free drops one */
+extern void frame_share(uint32_t addr);
+/* Returns 1 if the frame has more than one owner */
+extern int32_t frame_shared(uint32_t addr);
+
+/* End of the RAM managed by the allocator (4-MB aligned) */
+extern uint32_t frame_mem_top;
+/* Image cache slots backed by RAM, one bit per slot */
+extern uint32_t frame_image_slots;
+/* 1 if FS_REGION is backed by RAM and the file system image can move there */
+extern int32_t frame_fs_region_ok;
+/* Frame counters exported through the stats file */
+extern uint32_t frames_total;
+extern uint32_t frames_free;
+
+#endif
@@ -9,6 +9,7 @@ https://github.com/knusbaum/kernel/blob/master/idt.c
 
 
 #include "idt.h"
+#include "fpu.h"
 
 static void init_idt();
 static void set_table(int i);
@@ -118,6 +119,10 @@ void isr6 (){
 }
 
 void isr7 (){
+    /* CR0.TS is set until a task gets its own FPU state loaded */
+    if(fpu_trap() == 0)
+        return;
+
     strcpy((int8_t*) msg, (const int8_t*) "FPU Not Available Exception\n");
     terminal_write(1, (const void*) msg, strlen(msg));
     isr_ret = EXCEP_RET;
@@ -173,25 +178,21 @@ void isr13 (){
     return;
 }
 
-void isr14 (){
+void isr14 (uint32_t error_code){
     uint32_t fault_addr;
-    uint32_t errorNumber;
-    asm volatile (
-        "movl %%cr2, %%eax \n\
-        movl %%eax, %0\n\
-        popl %1 \n"\
-        : "=r" (fault_addr), "=r"(errorNumber) \
-        : \
-        : "%eax"\
-    );
+    asm volatile ("movl %%cr2, %0" : "=r" (fault_addr));
+
+    /* Not-present pages of the user page are loaded on demand */
+    if(demand_load(fault_addr, error_code) == 0)
+        return;
 
     strcpy((int8_t*) msg, (const int8_t*) "Page Fault\nPage Address:0x");
     terminal_write(1, (const void*) msg, strlen(msg));
-    itoa(fault_addr, (int8_t*) msg, 10);
+    itoa(fault_addr, (int8_t*) msg, 16);
     terminal_write(1, (const void*) msg, strlen(msg));
     strcpy((int8_t*) msg, (const int8_t*) "\nError Number:");
     terminal_write(1, (const void*) msg, strlen(msg));
-    itoa(errorNumber, (int8_t*) msg, 10);
+    itoa(error_code, (int8_t*) msg, 10);
     terminal_write(1, (const void*) msg, strlen(msg));
     strcpy((int8_t*) msg, (const int8_t*) "\n");
     terminal_write(1, (const void*) msg, strlen(msg));
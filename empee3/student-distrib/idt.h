@@ -6,6 +6,7 @@
 #include "types.h"
 #include "lib.h"
 #include "terminal.h"
+#include "paging.h"
 
 #define SYSCALL_ADDR        0x80
 #define RTC_ADDR            0x28
@@ -29,7 +30,7 @@ extern void isr10();
 extern void isr11();
 extern void isr12();
 extern void isr13();
-extern void isr14();
+extern void isr14(uint32_t error_code);
 extern void isr15();
 extern void isr16();
 extern void isr17();
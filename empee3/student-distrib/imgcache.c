@@ -0,0 +1,245 @@
+#include "imgcache.h"
+#include "frame.h"
+#include "stats.h"
+
+static image_cache_t image_cache[IMAGE_CACHE_SLOTS];
+static uint32_t exec_seq = 0;
+
+uint32_t image_cache_hits;
+uint32_t image_cache_misses;
+
+static void image_cache_parse(image_cache_t* entry);
+
+/*
+ * image_cache_init
+ *   DESCRIPTION: Empties the image cache and maps the slots of 32-MB to 48-MB
+ *                that frame_init found RAM for
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies page directory entries IMAGE_CACHE_PDE and up,
+ *                 called by paging_init before paging is enabled
+ */
+void image_cache_init(void) {
+    int i;
+
+    for(i = 0; i < IMAGE_CACHE_SLOTS; i++) {
+        image_cache[i].inode = NO_IMAGE_SLOT;
+        image_cache[i].refcount = 0;
+
+        /* Slots without RAM behind them are never handed out */
+        if(!(frame_image_slots & (1 << i)))
+            continue;
+
+        /* Attributes: global, page size, supervisor level, read/write, present */
+        page_directory[IMAGE_CACHE_PDE + i] = (IMAGE_CACHE_BASE + i * FOUR_MB) | 0x183;
+    }
+
+    stats_register("image_cache_hits", &image_cache_hits);
+    stats_register("image_cache_misses", &image_cache_misses);
+}
+
+/*
+ * image_cache_get
+ *   DESCRIPTION: Finds the cached image of an executable, or claims a free or
+ *                least recently used unreferenced slot for it
+ *   INPUTS: inode - inode of the executable
+ *           size  - size of the executable in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: slot index, NO_IMAGE_SLOT if every slot is in use
+ *   SIDE EFFECTS: Increments the slot's refcount
+ */
+int32_t image_cache_get(uint32_t inode, uint32_t size) {
+    int32_t i;
+    int32_t victim = NO_IMAGE_SLOT;
+
+    exec_seq++;
+
+    for(i = 0; i < IMAGE_CACHE_SLOTS; i++) {
+        if(image_cache[i].inode == inode) {
+            image_cache[i].refcount++;
+            image_cache[i].last_use = exec_seq;
+            return i;
+        }
+
+        /* Prefer empty slots, then the least recently used idle image */
+        if((image_cache[i].refcount == 0) && (frame_image_slots & (1 << i))) {
+            if((victim == NO_IMAGE_SLOT) || (image_cache[i].inode == NO_IMAGE_SLOT) ||
+               ((image_cache[victim].inode != NO_IMAGE_SLOT) &&
+                (image_cache[i].last_use < image_cache[victim].last_use)))
+                victim = i;
+        }
+    }
+
+    if(victim == NO_IMAGE_SLOT)
+        return NO_IMAGE_SLOT;
+
+    image_cache[victim].inode = inode;
+    image_cache[victim].size = size;
+    image_cache[victim].refcount = 1;
+    image_cache[victim].last_use = exec_seq;
+    memset(image_cache[victim].loaded, 0, sizeof(image_cache[victim].loaded));
+    image_cache_parse(&image_cache[victim]);
+
+    return victim;
+}
+
+/*
+ * image_cache_put
+ *   DESCRIPTION: Drops a reference on a cached image, the image stays cached
+ *   INPUTS: slot - slot returned by image_cache_get
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Decrements the slot's refcount
+ */
+void image_cache_put(int32_t slot) {
+    if((slot != NO_IMAGE_SLOT) && (image_cache[slot].refcount > 0))
+        image_cache[slot].refcount--;
+}
+
+/*
+ * image_cache_dup
+ *   DESCRIPTION: Takes another reference on a cached image (for a forked process)
+ *   INPUTS: slot - slot the caller already holds a reference on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Increments the slot's refcount
+ */
+void image_cache_dup(int32_t slot) {
+    if(slot != NO_IMAGE_SLOT)
+        image_cache[slot].refcount++;
+}
+
+/*
+ * image_cache_invalidate
+ *   DESCRIPTION: Forgets the cached image of a file that is about to be written,
+ *                truncated or removed. If processes are still running it, every
+ *                page not loaded yet is copied in first, so they keep the old
+ *                contents. The slot is reused once they exit. Must be called
+ *                before the file's blocks change
+ *   INPUTS: inode - inode of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: May fill frames of a matching slot, clears its inode
+ */
+void image_cache_invalidate(uint32_t inode) {
+    uint32_t page, num_pages;
+    int i;
+
+    for(i = 0; i < IMAGE_CACHE_SLOTS; i++) {
+        if(image_cache[i].inode != inode)
+            continue;
+
+        if(image_cache[i].refcount > 0) {
+            num_pages = (image_cache[i].size + FOUR_KB - 1) / FOUR_KB;
+            if(num_pages > IMAGE_MAX_PAGES)
+                num_pages = IMAGE_MAX_PAGES;
+            for(page = 0; page < num_pages; page++)
+                image_cache_page(i, page);
+        }
+
+        image_cache[i].inode = NO_IMAGE_SLOT;
+    }
+}
+
+/*
+ * image_cache_parse
+ *   DESCRIPTION: Marks the image pages that only hold read-only PT_LOAD segments.
+ *                Images are loaded flat at IMAGE_ADDR, so a segment is only
+ *                shareable if its file offset matches its place in that flat image.
+ *                A page touched by any writable segment is never shared
+ *   INPUTS: entry - cache entry with inode and size filled in
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Fills entry->text
+ */
+static void image_cache_parse(image_cache_t* entry) {
+    uint8_t header[ELF_HEADER_SIZE];
+    elf_phdr_t phdr;
+    uint32_t phoff, phnum, phentsize;
+    uint32_t i, page, first, last;
+
+    memset(entry->text, 0, sizeof(entry->text));
+
+    if(read_data(entry->inode, 0, header, ELF_HEADER_SIZE) != ELF_HEADER_SIZE)
+        return;
+
+    phoff = *(uint32_t*) (header + ELF_PHOFF);
+    phentsize = *(uint16_t*) (header + ELF_PHENTSIZE);
+    phnum = *(uint16_t*) (header + ELF_PHNUM);
+    if(phentsize < PHDR_SIZE)
+        return;
+
+    /* First pass: read-only segments become text */
+    for(i = 0; i < phnum; i++) {
+        if(read_data(entry->inode, phoff + i * phentsize, (uint8_t*) &phdr, PHDR_SIZE) != PHDR_SIZE)
+            return;
+        if((phdr.p_type != PT_LOAD) || (phdr.p_flags & PF_W) || (phdr.p_filesz == 0))
+            continue;
+        if((phdr.p_vaddr < IMAGE_ADDR) || (phdr.p_vaddr - IMAGE_ADDR != phdr.p_offset))
+            continue;
+
+        first = phdr.p_offset / FOUR_KB;
+        last = (phdr.p_offset + phdr.p_filesz - 1) / FOUR_KB;
+        for(page = first; (page <= last) && (page < IMAGE_MAX_PAGES); page++)
+            entry->text[page / 32] |= (1 << (page % 32));
+    }
+
+    /* Second pass: pages any writable segment lands in stay private */
+    for(i = 0; i < phnum; i++) {
+        if(read_data(entry->inode, phoff + i * phentsize, (uint8_t*) &phdr, PHDR_SIZE) != PHDR_SIZE)
+            return;
+        if((phdr.p_type != PT_LOAD) || !(phdr.p_flags & PF_W) || (phdr.p_memsz == 0))
+            continue;
+        if(phdr.p_vaddr < IMAGE_ADDR)
+            continue;
+
+        first = (phdr.p_vaddr - IMAGE_ADDR) / FOUR_KB;
+        last = (phdr.p_vaddr - IMAGE_ADDR + phdr.p_memsz - 1) / FOUR_KB;
+        for(page = first; (page <= last) && (page < IMAGE_MAX_PAGES); page++)
+            entry->text[page / 32] &= ~(1 << (page % 32));
+    }
+}
+
+/*
+ * image_cache_is_text
+ *   DESCRIPTION: Checks if an image page holds only read-only segments
+ *   INPUTS: slot - cache slot, page - page index from IMAGE_ADDR
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the page can stay shared and read-only, else 0
+ *   SIDE EFFECTS: none
+ */
+int32_t image_cache_is_text(int32_t slot, uint32_t page) {
+    return (image_cache[slot].text[page / 32] >> (page % 32)) & 1;
+}
+
+/*
+ * image_cache_page
+ *   DESCRIPTION: Returns the frame holding one page of a cached image, copying
+ *                the page in from the file system the first time it is used
+ *   INPUTS: slot - cache slot, page - page index from IMAGE_ADDR
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical (and kernel virtual) address of the frame
+ *   SIDE EFFECTS: May fill the frame and mark the page loaded
+ */
+uint32_t image_cache_page(int32_t slot, uint32_t page) {
+    image_cache_t* entry = &image_cache[slot];
+    uint32_t frame = IMAGE_CACHE_BASE + slot * FOUR_MB + page * FOUR_KB;
+    uint32_t offset = page * FOUR_KB;
+    uint32_t length;
+
+    if((entry->loaded[page / 32] >> (page % 32)) & 1) {
+        image_cache_hits++;
+        return frame;
+    }
+
+    image_cache_misses++;
+    memset((void*) frame, 0, FOUR_KB);
+    if(offset < entry->size) {
+        length = (entry->size - offset < FOUR_KB) ? entry->size - offset : FOUR_KB;
+        read_data(entry->inode, offset, (uint8_t*) frame, length);
+    }
+    entry->loaded[page / 32] |= (1 << (page % 32));
+
+    return frame;
+}
@@ -0,0 +1,72 @@
+#ifndef _IMGCACHE_H
+#define _IMGCACHE_H
+
+#include "types.h"
+#include "lib.h"
+#include "paging.h"
+#include "filesys.h"
+
+/* Physical memory holding cached program images (32-MB to 48-MB),
+ * identity mapped for the kernel, one 4-MB slot per cached image
+ */
+#define IMAGE_CACHE_BASE     0x02000000
+#define IMAGE_CACHE_PDE      8
+#define IMAGE_CACHE_SLOTS    4
+#define IMAGE_MAX_PAGES      1024
+#define IMAGE_BITMAP_WORDS   (IMAGE_MAX_PAGES / 32)
+#define NO_IMAGE_SLOT        -1
+
+/* ELF header/program header offsets (Docs Appendix C) */
+#define ELF_PHOFF            28
+#define ELF_PHENTSIZE        42
+#define ELF_PHNUM            44
+#define ELF_HEADER_SIZE      52
+#define PHDR_SIZE            32
+#define PT_LOAD              1
+#define PF_W                 2
+
+/* Program header, only the fields we look at */
+typedef struct elf_phdr {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} elf_phdr_t;
+
+/*
+ * inode - inode of the cached executable (NO_IMAGE_SLOT when empty)
+ * size - size of the executable in bytes
+ * refcount - number of running processes mapping this image
+ * last_use - exec sequence number, used to evict the least recently used image
+ * text - bitmap of image pages that hold only read-only segments
+ * loaded - bitmap of image pages already copied into the slot
+ */
+typedef struct image_cache {
+    int32_t inode;
+    uint32_t size;
+    uint32_t refcount;
+    uint32_t last_use;
+    uint32_t text[IMAGE_BITMAP_WORDS];
+    uint32_t loaded[IMAGE_BITMAP_WORDS];
+} image_cache_t;
+
+/* Maps the image cache into the kernel's address space */
+extern void image_cache_init(void);
+/* Takes a reference on the cached image of inode, returns its slot or NO_IMAGE_SLOT */
+extern int32_t image_cache_get(uint32_t inode, uint32_t size);
+/* Drops a reference taken by image_cache_get */
+extern void image_cache_put(int32_t slot);
+/* Takes one more reference on a slot already held (fork) */
+extern void image_cache_dup(int32_t slot);
+/* Returns the physical frame holding an image page, copying it in on first use */
+extern uint32_t image_cache_page(int32_t slot, uint32_t page);
+/* Forgets the cached image of a file whose contents changed */
+extern void image_cache_invalidate(uint32_t inode);
+/* Returns 1 if an image page can be shared read-only by every process */
+extern int32_t image_cache_is_text(int32_t slot, uint32_t page);
+
+#endif
@@ -16,8 +16,16 @@
 #include "terminal.h"
 #include "syscalls.h"
 #include "pit.h"
+#include "frame.h"
+#include "kmalloc.h"
+#include "fpu.h"
 
 #define RUN_TESTS
+
+/* Kernel command line, copied before paging hides the multiboot data */
+#define CMDLINE_LEN 256
+static int8_t boot_cmdline[CMDLINE_LEN];
+
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
@@ -43,8 +51,10 @@ void entry(unsigned long magic, unsigned long addr) {
     if (CHECK_FLAG(mbi->flags, 1))
         printf("boot_device = 0x%#x\n", (unsigned)mbi->boot_device);
     /* Is the command line passed? */
-    if (CHECK_FLAG(mbi->flags, 2))
+    if (CHECK_FLAG(mbi->flags, 2)) {
         printf("cmdline = %s\n", (char *)mbi->cmdline);
+        strncpy(boot_cmdline, (int8_t*)mbi->cmdline, CMDLINE_LEN - 1);
+    }
     uint32_t boot_addr = NULL;
     if (CHECK_FLAG(mbi->flags, 3)) {
         int mod_count = 0;
@@ -137,9 +147,23 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Initialize the PIC */
     i8259_init();
 
-    /* Initialize Paging */
+    /* Find free RAM, then map it in with the rest of paging */
+    frame_init(mbi);
     paging_init();
 
+    /* Initialize the kernel heap and the process table */
+    kmalloc_init();
+    pid_init();
+
+    /* Lazy FPU switching, the first FPU instruction of each task traps */
+    fpu_init();
+
+    /* The boot stack (below 8-MB) has no task, but interrupts taken on it
+     * still look up a PCB through its bottom word
+     */
+    static pcb_t boot_pcb;
+    *(pcb_t**) (EIGHT_MB - EIGHT_KB) = &boot_pcb;
+
     /* Initialize the Keyboard */
     keyboard_init();
 
@@ -149,9 +173,16 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Initialize the file system */
     fs_init(boot_addr);
 
+    /* Queue the shells of terminals 1 and 2 */
+    sched_init();
+
     /* Initialize the PIT */
     pit_init();
 
+    /* Tunables given on the command line, e.g. "pit_hz=100 sched_quantum=5" */
+    if (stats_set_text(boot_cmdline, strlen(boot_cmdline), 1) != 0)
+        printf("cmdline: rejected tunable values\n");
+
     /* Enable interrupts */
     sti();
 
@@ -160,9 +191,6 @@ void entry(unsigned long magic, unsigned long addr) {
     terminals[2].active_pid = 2;
 
     /* Run the shell */
-    int i;
-    for(i = 0; i < MAX_RUNNING_PROCESSES; i++)
-        pid_arr[i] = NOT_USED;
     execute((const uint8_t*) "shell");
 
 
@@ -0,0 +1,229 @@
+#include "kmalloc.h"
+#include "process.h"
+#include "stats.h"
+
+kmem_cache_t pcb_cache;
+kmem_cache_t file_cache;
+
+static kmem_cache_t kmalloc_caches[KMALLOC_CLASSES];
+static int8_t kmalloc_names[KMALLOC_CLASSES][KMEM_NAME_LEN];
+
+/* Registered caches, by id - 1 */
+static kmem_cache_t* kmem_caches[KMEM_MAX_CACHES];
+static uint32_t num_caches = 0;
+
+/* Owner of every low memory frame: a cache id, KMEM_LARGE | order for the
+ * first frame of a large kmalloc, KMEM_NO_OWNER otherwise
+ */
+static uint8_t kmem_owner[MAX_FRAMES];
+
+/*
+ * stat_name
+ *   DESCRIPTION: Builds "<prefix>_<suffix>" for a stats counter name
+ *   INPUTS: dest   - buffer of KMEM_STAT_LEN bytes
+ *           prefix - cache name
+ *           suffix - counter name
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Overwrites dest, truncating the name if needed
+ */
+static void stat_name(int8_t* dest, const int8_t* prefix, const int8_t* suffix) {
+    uint32_t len = 0;
+
+    while((*prefix != '\0') && (len < KMEM_STAT_LEN - 1))
+        dest[len++] = *prefix++;
+    if(len < KMEM_STAT_LEN - 1)
+        dest[len++] = '_';
+    while((*suffix != '\0') && (len < KMEM_STAT_LEN - 1))
+        dest[len++] = *suffix++;
+    dest[len] = '\0';
+}
+
+/*
+ * kmalloc_init
+ *   DESCRIPTION: Registers the kmalloc size classes ("kmalloc-32" and up) and
+ *                the PCB and file object caches
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Called once paging maps the frame allocator's memory
+ */
+void kmalloc_init(void) {
+    int8_t num[KMEM_NAME_LEN];
+    uint32_t i;
+
+    for(i = 0; i < KMALLOC_CLASSES; i++) {
+        strcpy(kmalloc_names[i], "kmalloc-");
+        itoa(1 << (KMALLOC_MIN_SHIFT + i), num, 10);
+        strncpy(kmalloc_names[i] + strlen(kmalloc_names[i]), num,
+                KMEM_NAME_LEN - 1 - strlen(kmalloc_names[i]));
+        kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i], 1 << (KMALLOC_MIN_SHIFT + i));
+    }
+
+    kmem_cache_init(&pcb_cache, "pcb", sizeof(pcb_t));
+    kmem_cache_init(&file_cache, "file", sizeof(file_t));
+}
+
+/*
+ * kmem_cache_init
+ *   DESCRIPTION: Sets up an empty cache of objects of one size
+ *   INPUTS: cache - cache to set up
+ *           name  - name shown in the stats file
+ *           size  - object size in bytes, at most KMALLOC_MAX_SIZE
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the size is bad or there are too many caches
+ *   SIDE EFFECTS: Registers the cache's in_use and allocs counters
+ */
+int32_t kmem_cache_init(kmem_cache_t* cache, const int8_t* name, uint32_t size) {
+    if((size == 0) || (size > KMALLOC_MAX_SIZE) || (num_caches >= KMEM_MAX_CACHES))
+        return -1;
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+    /* Free objects hold the free list link, so keep them word aligned */
+    cache->size = (size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    cache->free_list = NULL;
+
+    kmem_caches[num_caches++] = cache;
+    cache->id = num_caches;
+
+    stat_name(cache->stat_names[0], cache->name, "in_use");
+    stat_name(cache->stat_names[1], cache->name, "allocs");
+    stats_register(cache->stat_names[0], &cache->in_use);
+    stats_register(cache->stat_names[1], &cache->allocs);
+
+    return 0;
+}
+
+/*
+ * kmem_cache_grow
+ *   DESCRIPTION: Carves a new frame into objects and puts them on the free list
+ *   INPUTS: cache - cache that ran out of objects
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no free frame
+ *   SIDE EFFECTS: Takes a frame from the frame allocator
+ */
+static int32_t kmem_cache_grow(kmem_cache_t* cache) {
+    uint32_t slab = frame_alloc();
+    uint32_t obj;
+
+    if(slab == NO_FRAME)
+        return -1;
+
+    kmem_owner[slab / FOUR_KB] = cache->id;
+    cache->slabs++;
+
+    /* Push from the end so objects come out in address order */
+    for(obj = slab + (FOUR_KB / cache->size - 1) * cache->size; obj >= slab; obj -= cache->size) {
+        *(void**) obj = cache->free_list;
+        cache->free_list = (void*) obj;
+        if(obj == slab)
+            break;
+    }
+
+    return 0;
+}
+
+/*
+ * kmem_cache_alloc
+ *   DESCRIPTION: Pops an object off the cache's free list, growing it if empty
+ *   INPUTS: cache - cache to allocate from
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the object (not zeroed), NULL on failure
+ *   SIDE EFFECTS: Updates the cache counters
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    uint32_t flags;
+    void* obj = NULL;
+
+    cli_and_save(flags);
+    if((cache->free_list != NULL) || (kmem_cache_grow(cache) == 0)) {
+        obj = cache->free_list;
+        cache->free_list = *(void**) obj;
+        cache->allocs++;
+        cache->in_use++;
+    }
+    restore_flags(flags);
+
+    return obj;
+}
+
+/*
+ * kmem_cache_free
+ *   DESCRIPTION: Pushes an object back on the cache's free list
+ *   INPUTS: cache - cache the object came from
+ *           obj   - object to free
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Updates the cache counters
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    uint32_t flags;
+
+    if(obj == NULL)
+        return;
+
+    cli_and_save(flags);
+    *(void**) obj = cache->free_list;
+    cache->free_list = obj;
+    cache->frees++;
+    cache->in_use--;
+    restore_flags(flags);
+}
+
+/*
+ * kmalloc
+ *   DESCRIPTION: Allocates from the smallest size class that fits, or a
+ *                power-of-two run of frames for anything over KMALLOC_MAX_SIZE
+ *   INPUTS: size - bytes needed
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the memory (not zeroed), NULL on failure
+ *   SIDE EFFECTS: May take frames from the frame allocator
+ */
+void* kmalloc(uint32_t size) {
+    uint32_t shift = KMALLOC_MIN_SHIFT;
+    uint32_t order = 0;
+    uint32_t run;
+
+    if(size == 0)
+        return NULL;
+
+    if(size <= KMALLOC_MAX_SIZE) {
+        while((1 << shift) < size)
+            shift++;
+        return kmem_cache_alloc(&kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+    }
+
+    while(((uint32_t) FOUR_KB << order) < size)
+        order++;
+    if((run = frame_alloc_run(1 << order)) == NO_FRAME)
+        return NULL;
+    kmem_owner[run / FOUR_KB] = KMEM_LARGE | order;
+
+    return (void*) run;
+}
+
+/*
+ * kfree
+ *   DESCRIPTION: Frees memory from kmalloc or kmem_cache_alloc, finding the
+ *                owning cache from the frame the pointer lies in
+ *   INPUTS: ptr - memory to free
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Pointers the heap did not hand out are ignored
+ */
+void kfree(void* ptr) {
+    uint32_t frame = (uint32_t) ptr / FOUR_KB;
+    uint8_t owner;
+
+    if((ptr == NULL) || (frame >= MAX_FRAMES))
+        return;
+
+    owner = kmem_owner[frame];
+    if(owner & KMEM_LARGE) {
+        kmem_owner[frame] = KMEM_NO_OWNER;
+        frame_free_run((uint32_t) ptr, 1 << (owner & ~KMEM_LARGE));
+    } else if((owner != KMEM_NO_OWNER) && (owner <= num_caches)) {
+        kmem_cache_free(kmem_caches[owner - 1], ptr);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef _KMALLOC_H
+#define _KMALLOC_H
+
+#include "types.h"
+#include "lib.h"
+#include "frame.h"
+
+/* Size classes of kmalloc, powers of two from 32 bytes to half a page.
+ * Bigger requests get whole frames from the frame allocator
+ */
+#define KMALLOC_MIN_SHIFT   5
+#define KMALLOC_MAX_SHIFT   11
+#define KMALLOC_CLASSES     (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMALLOC_MAX_SIZE    (1 << KMALLOC_MAX_SHIFT)
+
+/* Every cache gets an id, kmem_owner[] maps a frame back to its cache */
+#define KMEM_MAX_CACHES     16
+#define KMEM_NAME_LEN       16
+#define KMEM_STAT_LEN       24
+#define KMEM_LARGE          0x80
+#define KMEM_NO_OWNER       0
+
+/*
+ * name - cache name, prefix of its stats counters
+ * size - object size, rounded up to 4 bytes
+ * id - index of the cache in kmem_caches[] plus one
+ * free_list - free objects, linked through their first word
+ * allocs, frees - objects handed out and given back so far
+ * in_use - objects currently allocated
+ * slabs - frames carved up for this cache (kept once grown)
+ */
+typedef struct kmem_cache {
+    int8_t name[KMEM_NAME_LEN];
+    uint32_t size;
+    uint32_t id;
+    void* free_list;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t in_use;
+    uint32_t slabs;
+    int8_t stat_names[2][KMEM_STAT_LEN];
+} kmem_cache_t;
+
+/* Dedicated caches for the kernel's fixed-size objects */
+extern kmem_cache_t pcb_cache;
+extern kmem_cache_t file_cache;
+
+/* Sets up the kmalloc size classes and the object caches, needs paging */
+extern void kmalloc_init(void);
+/* Registers a cache of objects of the given size, 0 on success */
+extern int32_t kmem_cache_init(kmem_cache_t* cache, const int8_t* name, uint32_t size);
+/* Takes an object from a cache, NULL when memory is exhausted */
+extern void* kmem_cache_alloc(kmem_cache_t* cache);
+/* Puts an object back on its cache's free list */
+extern void kmem_cache_free(kmem_cache_t* cache, void* obj);
+/* General purpose allocation, NULL on failure */
+extern void* kmalloc(uint32_t size);
+/* Frees memory from kmalloc or kmem_cache_alloc, NULL is ignored */
+extern void kfree(void* ptr);
+
+#endif
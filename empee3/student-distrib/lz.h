@@ -0,0 +1,16 @@
+#ifndef _LZ_H
+#define _LZ_H
+
+#include "types.h"
+
+/* LZ4 block format: sequences of (token, literals, offset, match length)
+ * token high nibble = literal count, low nibble = match length - LZ_MIN_MATCH,
+ * a nibble of 15 is extended by following bytes (255 means keep adding)
+ */
+#define LZ_MIN_MATCH    4
+#define LZ_RUN_MASK     15
+
+/* Decompresses src into dst, fails if the output would not be exactly dst_len bytes */
+extern int32_t lz_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len);
+
+#endif
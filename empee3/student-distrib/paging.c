@@ -1,15 +1,27 @@
 #include "paging.h"
+#include "process.h"
+#include "syscalls.h"
+#include "imgcache.h"
+#include "frame.h"
 
 uint32_t page_directory[1024] __attribute__((aligned(4096)));
 uint32_t first_page_table[1024] __attribute__((aligned(4096)));
-uint32_t user_vidmem_page_table[1024] __attribute__((aligned(4096)));
+
+uint32_t image_pages;
+uint32_t image_pages_loaded;
+uint32_t cow_faults;
+uint32_t tlb_flushes;
+uint32_t tlb_page_flushes;
 
 /*
  * paging_init
  *   DESCRIPTION: Initializes paging w/
                 0 to 4-MB: 4-kB pages marked not present (except VIDEO_MEMORY)
                 4 to 8-MB: 4-MB page for Kernel
-                8 to 4-GB: 4-MB pages marked not present
+                8-MB to the top of RAM (at most 128-MB): 4-MB kernel pages
+                over the frames handed out by the frame allocator
+                the rest up to 4-GB: 4-MB pages marked not present
+                User mappings live in per-process page directories (create_page_directory)
  *   INPUTS:
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -32,29 +44,39 @@ void paging_init() {
     }
 
     /* Map 4-kB page (within 0 to 4-MB) to Video Memory
-     * attributes: supervisor level, read/write, present
+     * attributes: global, supervisor level, read/write, present
      * 184 == 0xB8 == Linear Address[21:12]
      */
-    first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x3;
+    first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x103;
 
     /* 4-MB to 8-MB for the Kernel to physical memory at 4-MB to 8-MB
-     * attributes: page size, supervisor level, read/write, present
+     * attributes: global, page size, supervisor level, read/write, present
      */
-    page_directory[1] = (uint32_t) KERNEL_PAGE | 0x83;
+    page_directory[1] = (uint32_t) KERNEL_PAGE | 0x183;
 
     /* 8-MB to 4-GB marked not present */
     for(i = 2; i < 1024; i++) {
         page_directory[i] = 0x0;
     }
 
-    /* Set up page directory and page table for user's vidmap at 2-GB
-     * attributes: user level, read/write, present
+    /* Identity map the frames the allocator hands out (frame_init has run)
+     * attributes: global, page size, supervisor level, read/write, present
      */
-    page_directory[512] = ((uint32_t) user_vidmem_page_table) | 0x7;
-    blank_table(user_vidmem_page_table);
+    for(i = LOWMEM_START / FOUR_MB; i < frame_mem_top / FOUR_MB; i++) {
+        page_directory[i] = (i * FOUR_MB) | 0x183;
+    }
+
+    /* 32 to 48-MB holds the shared program image cache */
+    image_cache_init();
 
     loadPageDirectory((uint32_t) page_directory);
     enablePaging();
+
+    stats_register("image_pages", &image_pages);
+    stats_register("image_pages_loaded", &image_pages_loaded);
+    stats_register("cow_faults", &cow_faults);
+    stats_register("tlb_flushes", &tlb_flushes);
+    stats_register("tlb_page_flushes", &tlb_page_flushes);
 }
 
 /* Sets all page directory entries to not present */
@@ -72,3 +94,333 @@ void blank_table(uint32_t* table) {
         table[i] = 0x0;
     }
 }
+
+/*
+ * create_page_directory
+ *   DESCRIPTION: Gives a process its own page directory. The kernel entries are
+ *                copied from page_directory and point at the same (global) pages
+ *                and page tables; the user part starts out empty
+ *   INPUTS: pcb - process that gets the directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if no frame is free
+ *   SIDE EFFECTS: Sets pcb->page_dir to a frame from the frame allocator
+ */
+int32_t create_page_directory(pcb_t* pcb) {
+    uint32_t frame = frame_alloc();
+
+    if(frame == NO_FRAME)
+        return -1;
+
+    /* Kernel entries never change after boot, so a copy stays in sync */
+    memcpy((void*) frame, (void*) page_directory, FOUR_KB);
+    pcb->page_dir = (uint32_t*) frame;
+    return 0;
+}
+
+/*
+ * map_user_process
+ *   DESCRIPTION: Switches to the address space of a process by loading its page
+ *                directory into CR3. Kernel entries are global and stay cached.
+ *                A task without a directory yet (a shell started at boot that
+ *                did not execute) gets the kernel page directory
+ *   INPUTS: pcb - process whose address space should be visible
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Loads CR3, dropping the non-global TLB entries
+ */
+void map_user_process(pcb_t* pcb) {
+    loadPageDirectory((uint32_t) ((pcb->page_dir != NULL) ? pcb->page_dir : page_directory));
+    tlb_flushes++;
+}
+
+/*
+ * copy_user_pages
+ *   DESCRIPTION: Gives a forked process its own page directory with a copy of
+ *                every user page table of the parent. Private pages are not
+ *                copied: both sides map the same frame read-only and marked
+ *                copy on write, and the frame gets one more owner. Shared
+ *                pages (image cache, mapped files, vidmap) are mapped as they are
+ *   INPUTS: parent - process being forked (the current one)
+ *           child  - new process, page_dir is NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if frames ran out (the caller frees the
+ *                 child's partial address space with free_user_pages)
+ *   SIDE EFFECTS: Write-protects the parent's private pages and flushes the TLB
+ */
+int32_t copy_user_pages(pcb_t* parent, pcb_t* child) {
+    uint32_t pde, i, table;
+    uint32_t* from;
+    uint32_t* to;
+    int32_t result = 0;
+
+    if(create_page_directory(child) == -1)
+        return -1;
+
+    for(pde = USER_PDE; (pde <= VIDMAP_PDE) && (result == 0); pde++) {
+        if(!(parent->page_dir[pde] & 0x1))
+            continue;
+        if((table = frame_alloc()) == NO_FRAME) {
+            result = -1;
+            continue;
+        }
+        from = (uint32_t*) (parent->page_dir[pde] & ~(FOUR_KB - 1));
+        to = (uint32_t*) table;
+
+        for(i = 0; i < 1024; i++) {
+            if(from[i] & PTE_OWNED) {
+                /* Attributes: copy on write, owned, user level, read only, present */
+                from[i] = (from[i] & ~0x2) | PTE_COW;
+                frame_share(from[i] & ~(FOUR_KB - 1));
+            }
+            to[i] = from[i];
+        }
+        child->page_dir[pde] = table | (parent->page_dir[pde] & (FOUR_KB - 1));
+    }
+
+    /* The parent may still have writable translations of its private pages */
+    flushTLB();
+    return result;
+}
+
+/*
+ * free_user_pages
+ *   DESCRIPTION: Gives every frame a process owns back to the frame allocator:
+ *                the private pages of its user page tables, the page tables
+ *                and finally the page directory
+ *   INPUTS: pcb - process being torn down
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: If the directory is the one in CR3, the kernel page directory
+ *                 is loaded first, the caller maps another process before
+ *                 returning to user level. Mapped file blocks and image cache
+ *                 frames stay
+ */
+void free_user_pages(pcb_t* pcb) {
+    uint32_t pde, i, cr3;
+    uint32_t* table;
+
+    if(pcb->page_dir == NULL)
+        return;
+
+    /* The frame may be reused by the next allocation, so stop walking it */
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+    if(cr3 == (uint32_t) pcb->page_dir)
+        loadPageDirectory((uint32_t) page_directory);
+
+    for(pde = USER_PDE; pde <= VIDMAP_PDE; pde++) {
+        if(!(pcb->page_dir[pde] & 0x1))
+            continue;
+        table = (uint32_t*) (pcb->page_dir[pde] & ~(FOUR_KB - 1));
+        for(i = 0; i < 1024; i++) {
+            if(table[i] & PTE_OWNED)
+                frame_free(table[i] & ~(FOUR_KB - 1));
+        }
+        frame_free((uint32_t) table);
+    }
+
+    frame_free((uint32_t) pcb->page_dir);
+    pcb->page_dir = NULL;
+}
+
+/*
+ * user_pte
+ *   DESCRIPTION: Finds the page table entry of a user address in a process'
+ *                page directory. Page tables are frames from the frame
+ *                allocator (identity mapped), added the first time an address
+ *                in their 4-MB is mapped
+ *   INPUTS: pcb    - process whose address space is looked up
+ *           vaddr  - user virtual address
+ *           create - allocate the page table if it is missing
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the entry, NULL if the page table is missing
+ *                 (and create is 0, or no frame is free)
+ *   SIDE EFFECTS: May add a page table to the page directory
+ */
+uint32_t* user_pte(pcb_t* pcb, uint32_t vaddr, int32_t create) {
+    uint32_t pde = vaddr / FOUR_MB;
+    uint32_t table;
+
+    if(!(pcb->page_dir[pde] & 0x1)) {
+        if(!create || ((table = frame_alloc()) == NO_FRAME))
+            return NULL;
+        blank_table((uint32_t*) table);
+
+        /* Attributes: user level, read/write, present (read-only is set per page)
+         * The entry was not present, so nothing stale can be in the TLB
+         */
+        pcb->page_dir[pde] = table | 0x7;
+    }
+
+    table = pcb->page_dir[pde] & ~(FOUR_KB - 1);
+    return (uint32_t*) table + (vaddr / FOUR_KB) % 1024;
+}
+
+/*
+ * unmap_user_pages
+ *   DESCRIPTION: Removes the mappings of the user pages in [start, end) and gives
+ *                the private frames among them back to the frame allocator.
+ *                Page tables stay until the process exits
+ *   INPUTS: pcb   - process whose address space is changed
+ *           start - first page, 4-kB aligned
+ *           end   - end of the range, 4-kB aligned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies user page table entries, and the TLB if the process
+ *                 is the current one
+ */
+void unmap_user_pages(pcb_t* pcb, uint32_t start, uint32_t end) {
+    uint32_t addr;
+    uint32_t* pte;
+    int32_t current = (pcb == get_pcb());
+
+    for(addr = start; addr < end; addr += FOUR_KB) {
+        pte = user_pte(pcb, addr, 0);
+        if((pte == NULL) || !(*pte & 0x1))
+            continue;
+        if(*pte & PTE_OWNED)
+            frame_free(*pte & ~(FOUR_KB - 1));
+        *pte = 0;
+        if(current)
+            flushTLBEntry(addr);
+    }
+}
+
+/*
+ * set_user_vidmap
+ *   DESCRIPTION: Points the vidmap page of a process at the screen or at a
+ *                terminal's backing page. Processes without vidmap are left alone
+ *   INPUTS: pcb        - process to update
+ *           video_page - physical address of the 4-kB video page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies the process' vidmap page table entry, and the TLB
+ *                 if the process is the current one
+ */
+void set_user_vidmap(pcb_t* pcb, uint32_t video_page) {
+    uint32_t* pte;
+
+    if(pcb->page_dir == NULL)
+        return;
+    pte = user_pte(pcb, TWO_GB, 0);
+    if((pte == NULL) || !(*pte & 0x1))
+        return;
+
+    /* Attributes: user level, read/write, present */
+    *pte = video_page | 0x7;
+    if(pcb == get_pcb())
+        flushTLBEntry(TWO_GB);
+}
+
+/*
+ * demand_load
+ *   DESCRIPTION: Resolves a page fault in the user address space of the current
+ *                process. Image pages are mapped read-only to the shared frame in
+ *                the image cache; a write to an image page that is not text gets
+ *                a private copy in a frame from the frame allocator.
+ *                Other pages of the image page (and images that did not fit in
+ *                the cache) are backed by a private frame, zero filled and loaded
+ *                from the image. Heap pages below the break and stack pages above
+ *                USER_STACK_LIMIT are zero filled. Writes to pages shared by
+ *                fork get a private copy
+ *   INPUTS: fault_addr - faulting linear address (CR2)
+ *           error_code - error code pushed by the processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the fault was resolved, -1 if it is a real fault
+ *   SIDE EFFECTS: Modifies one user page table entry, may add a page table
+ */
+int32_t demand_load(uint32_t fault_addr, uint32_t error_code) {
+    pcb_t* pcb = get_pcb();
+    uint32_t page_addr = fault_addr & ~(FOUR_KB - 1);
+    uint32_t* pte;
+    uint32_t private_frame;
+    uint32_t image_end = IMAGE_ADDR + pcb->image_size;
+    uint32_t image_page = (page_addr - IMAGE_ADDR) / FOUR_KB;
+    int32_t in_image = (page_addr >= IMAGE_ADDR) && (page_addr < image_end);
+    uint32_t start, end, shared;
+
+    if(((fault_addr < USER_PAGE_START) || (fault_addr >= USER_PAGE_END)) &&
+       ((fault_addr < USER_HEAP_START) || (fault_addr >= pcb->brk)) &&
+       ((fault_addr < USER_STACK_LIMIT) || (fault_addr >= USER_STACK_TOP)))
+        return -1;
+
+    /* Kernel code running before the first process has no user space */
+    if((pcb->page_dir == NULL) || ((pte = user_pte(pcb, page_addr, 1)) == NULL))
+        return -1;
+
+    /* A write to a page shared by fork: copy it, unless every other owner is gone */
+    if((error_code & PF_PRESENT) && (error_code & PF_WRITE) && (*pte & PTE_COW)) {
+        shared = *pte & ~(FOUR_KB - 1);
+        if(frame_shared(shared)) {
+            if((private_frame = frame_alloc()) == NO_FRAME)
+                return -1;
+            memcpy((void*) private_frame, (void*) shared, FOUR_KB);
+            frame_free(shared);
+
+            /* Attributes: owned, user level, read/write, present */
+            *pte = private_frame | PTE_OWNED | 0x7;
+            cow_faults++;
+        } else {
+            *pte = (*pte & ~PTE_COW) | 0x2;
+        }
+        flushTLBEntry(page_addr);
+        return 0;
+    }
+
+    if(error_code & PF_PRESENT) {
+        /* Only writes to shared, non-text image pages are resolvable (copy on write) */
+        if(!(error_code & PF_WRITE) || !in_image || (pcb->image_slot == NO_IMAGE_SLOT) ||
+           image_cache_is_text(pcb->image_slot, image_page))
+            return -1;
+
+        if((private_frame = frame_alloc()) == NO_FRAME)
+            return -1;
+        shared = *pte & ~(FOUR_KB - 1);
+
+        /* Attributes: owned, user level, read/write, present */
+        *pte = private_frame | PTE_OWNED | 0x7;
+        flushTLBEntry(page_addr);
+
+        /* Cache frames are identity mapped, so the shared copy is still readable */
+        memcpy((void*) page_addr, (void*) shared, FOUR_KB);
+        cow_faults++;
+        return 0;
+    }
+
+    /* Image pages come from the image cache, read-only until written
+     * Attributes: user level, read only, present
+     * Not-present entries are never cached in the TLB, so no flush is needed
+     */
+    if(in_image && (pcb->image_slot != NO_IMAGE_SLOT)) {
+        shared = image_cache_page(pcb->image_slot, image_page);
+        pcb->pages_loaded++;
+
+        /* A first touch that is already a write skips the read-only step */
+        if((error_code & PF_WRITE) && !image_cache_is_text(pcb->image_slot, image_page)) {
+            if((private_frame = frame_alloc()) == NO_FRAME)
+                return -1;
+            *pte = private_frame | PTE_OWNED | 0x7;
+            memcpy((void*) page_addr, (void*) shared, FOUR_KB);
+            cow_faults++;
+            return 0;
+        }
+
+        *pte = shared | 0x5;
+        return 0;
+    }
+
+    /* Attributes: owned, user level, read/write, present */
+    if((private_frame = frame_alloc()) == NO_FRAME)
+        return -1;
+    *pte = private_frame | PTE_OWNED | 0x7;
+    memset((void*) page_addr, 0, FOUR_KB);
+
+    /* Copy the part of the program image that falls inside this page */
+    if((page_addr + FOUR_KB > IMAGE_ADDR) && (page_addr < image_end)) {
+        start = (page_addr > IMAGE_ADDR) ? page_addr : IMAGE_ADDR;
+        end = (page_addr + FOUR_KB < image_end) ? page_addr + FOUR_KB : image_end;
+        read_data(pcb->image_inode, start - IMAGE_ADDR, (uint8_t*) start, end - start);
+        pcb->pages_loaded++;
+    }
+
+    return 0;
+}
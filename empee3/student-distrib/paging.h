@@ -18,10 +18,51 @@
 #define EIGHT_KB        0x00002000
 #define TWO_GB          0x80000000
 
-#define USER_STACK      0x083FFFFC
+/* User address space, private to each process' page directory:
+ *   128-MB  program image page (image, data and bss)
+ *   132-MB  heap, grows up to the break set by sbrk/brk
+ *     1-GB  read-only file mappings (mmap)
+ *     2-GB  stack top, the stack grows down to USER_STACK_LIMIT
+ *     2-GB  vidmap page, right above the stack
+ */
 #define USER_PAGE_START 0x08000000
 #define USER_PAGE_END   0x08400000
 
+#define USER_HEAP_START 0x08400000
+#define USER_HEAP_END   0x40000000
+
+#define USER_MMAP_START 0x40000000
+#define USER_MMAP_END   0x44000000
+
+#define USER_STACK_LIMIT 0x7F800000
+#define USER_STACK_TOP  0x80000000
+#define USER_STACK      0x7FFFFFFC
+
+/* Page fault error code bits */
+#define PF_PRESENT      0x1
+#define PF_WRITE        0x2
+
+/* Page directory entries private to a process, first user one to vidmap */
+#define USER_PDE        (USER_PAGE_START / FOUR_MB)
+#define VIDMAP_PDE      (TWO_GB / FOUR_MB)
+
+/* Page table entry bit left to the OS: the frame was allocated for this
+ * process and is freed with it (shared image and file frames are not)
+ */
+#define PTE_OWNED       0x200
+
+/* Second OS bit: an owned page shared read-only with a forked process,
+ * the first write gets a private copy
+ */
+#define PTE_COW         0x400
+
+/* Global bit of a page directory/table entry: kept across CR3 reloads
+ * (CR4.PGE is set), so only kernel mappings may use it
+ */
+#define PAGE_GLOBAL     0x100
+
+struct pcb;
+
 /* Initializes paging  */
 extern void paging_init();
 
@@ -37,14 +78,49 @@ extern void loadPageDirectory(uint32_t ptr);
 /* Enables 4-MB pages and then enables paging  */
 extern void enablePaging();
 
-/* Flush the TLB */
+/* Flush the non-global entries of the TLB */
 extern void flushTLB();
 
-/* Both are 4kB aligned (Temporary Solution)
- * Write a page allocator for proper solution
+/* Flush the TLB entry of the page holding addr */
+extern void flushTLBEntry(uint32_t addr);
+
+/* Gives a process its own page directory, sharing the kernel entries */
+extern int32_t create_page_directory(struct pcb* pcb);
+
+/* Switches to the address space of the given process (one CR3 load) */
+extern void map_user_process(struct pcb* pcb);
+
+/* Gives a forked process a copy-on-write copy of its parent's address space */
+extern int32_t copy_user_pages(struct pcb* parent, struct pcb* child);
+
+/* Frees a process' private frames, its page tables and its page directory */
+extern void free_user_pages(struct pcb* pcb);
+
+/* Returns the page table entry of a user address, allocating its page table if asked */
+extern uint32_t* user_pte(struct pcb* pcb, uint32_t vaddr, int32_t create);
+
+/* Unmaps the user pages in [start, end), freeing the private ones */
+extern void unmap_user_pages(struct pcb* pcb, uint32_t start, uint32_t end);
+
+/* Points a process' vidmap page (if it has one) at the given video page */
+extern void set_user_vidmap(struct pcb* pcb, uint32_t video_page);
+
+/* Resolves user page faults: pages on demand and copy on write */
+extern int32_t demand_load(uint32_t fault_addr, uint32_t error_code);
+
+/* Kernel page directory: used before the first process runs and as the
+ * template whose kernel entries every process' directory starts from
  */
 extern uint32_t page_directory[1024] __attribute__((aligned(4096)));
 extern uint32_t first_page_table[1024] __attribute__((aligned(4096)));
-extern uint32_t user_vidmem_page_table[1024] __attribute__((aligned(4096)));
+
+/* Image pages of exited programs, and how many of them were actually loaded */
+extern uint32_t image_pages;
+extern uint32_t image_pages_loaded;
+/* Private copies made of shared image pages and of pages shared by fork */
+extern uint32_t cow_faults;
+/* Full (non-global) TLB flushes and single page invalidations */
+extern uint32_t tlb_flushes;
+extern uint32_t tlb_page_flushes;
 
 #endif
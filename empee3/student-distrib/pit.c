@@ -1,4 +1,5 @@
 #include "pit.h"
+#include "stats.h"
 
 /*
 The PIT implememntation is based up on this documentation:
@@ -7,37 +8,200 @@ https://wiki.osdev.org/Programmable_Interval_Timer
 Note that we only referred to it in order to get correct values and port.
 */
 
-// Global counter for terminal
-int terminal_cycle;
+/* The PIT is only armed while a task waits for the processor: channel 0 runs
+ * one-shot (mode 0) up to the running task's time slice deadline. Deadlines
+ * longer than the 16-bit counter are reached in several interrupts
+ */
+static uint32_t pit_armed;
+static uint32_t pit_counts_left;
+
+/* Time stamp counter cycles per millisecond, measured against the PIT */
+uint32_t tsc_per_ms;
+uint32_t pit_interrupts;
+/* Scheduler tick rate, tunable as "pit_hz" */
+uint32_t pit_hz;
+
+/*
+ * pit_read_status
+ *   DESCRIPTION: Latches and reads the status byte of channel 0 (read-back command)
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the status, PIT_STATUS_OUT is the state of the OUT pin
+ *   SIDE EFFECTS: none
+ */
+static uint32_t pit_read_status(void)
+{
+    outb(READ_BACK_0_PIT, COMMAND_RGSTR_PIT);
+    return inb(CHANNEL_0_RW_PIT);
+}
+
+/*
+ * pit_load
+ *   DESCRIPTION: Starts a one-shot count on channel 0
+ *   INPUTS: counts - PIT input clock cycles until the interrupt (1 to 65535)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Restarts channel 0
+ */
+static void pit_load(uint32_t counts)
+{
+    outb(MODE_0, COMMAND_RGSTR_PIT);
+    outb(counts & MASK_FREQ, CHANNEL_0_RW_PIT);
+    outb(counts >> SHIFT_BIT, CHANNEL_0_RW_PIT);
+}
+
+/*
+ * pit_load_next
+ *   DESCRIPTION: Loads the next part of the armed deadline
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Restarts channel 0
+ */
+static void pit_load_next(void)
+{
+    uint32_t counts = (pit_counts_left > PIT_MAX_COUNT) ? PIT_MAX_COUNT : pit_counts_left;
+
+    if(counts == 0)
+        counts = 1;
+    pit_counts_left -= (counts < pit_counts_left) ? counts : pit_counts_left;
+    pit_load(counts);
+}
 
 /*
  * pit_init()
- *   DESCRIPTION: Initialize PIT frequency to 29,829 Hz
+ *   DESCRIPTION: Measures the time stamp counter against the PIT, then leaves
+ *                the PIT disarmed until the scheduler needs a deadline
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Enables PIT interrupts
+ *   SIDE EFFECTS: Enables PIT interrupts, busy waits for PIT_CALIBRATE_MS
  */
 void pit_init()
 {
+    uint32_t start, end;
+
     cli();
-    outb(MAX_FREQ_PIT/COUNTER_DIVIDER & MASK_FREQ, CHANNEL_0_RW_PIT);
-    outb(MAX_FREQ_PIT/COUNTER_DIVIDER >> SHIFT_BIT, CHANNEL_0_RW_PIT);
-    outb(MODE_2, COMMAND_RGSTR_PIT);
+    pit_armed = 0;
+    pit_counts_left = 0;
+    pit_interrupts = 0;
+    pit_hz = PIT_HZ;
+    stats_register("pit_interrupts", &pit_interrupts);
+    stats_register_tunable("pit_hz", &pit_hz, pit_set_hz);
+
+    /* OUT goes low when the mode is set and high at terminal count, so a
+     * stale or wrapped count read cannot end the wait early
+     */
+    pit_load(MAX_FREQ_PIT / 1000 * PIT_CALIBRATE_MS);
+    asm volatile("rdtsc" : "=a"(start) : : "edx");
+    while((pit_read_status() & (PIT_STATUS_OUT | PIT_STATUS_NULL)) != PIT_STATUS_OUT) {}
+    asm volatile("rdtsc" : "=a"(end) : : "edx");
+    tsc_per_ms = (end - start) / PIT_CALIBRATE_MS;
+    stats_register("tsc_per_ms", &tsc_per_ms);
+
     enable_irq(IRQ_PIT);
     sti();
 }
 
+/*
+ * pit_set_hz
+ *   DESCRIPTION: Changes the scheduler tick rate, which time slices are
+ *                counted in. An armed deadline keeps its length
+ *   INPUTS: hz - ticks per second, PIT_HZ_MIN to PIT_HZ_MAX
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if hz is out of range
+ *   SIDE EFFECTS: none
+ */
+int32_t pit_set_hz(uint32_t hz)
+{
+    if((hz < PIT_HZ_MIN) || (hz > PIT_HZ_MAX))
+        return -1;
+
+    pit_hz = hz;
+    return 0;
+}
+
+/*
+ * pit_arm
+ *   DESCRIPTION: Sets the next deadline, replacing any armed one
+ *   INPUTS: ticks - deadline in pit_hz ticks from now
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: pit_handler calls sched_tick when the deadline passes
+ */
+void pit_arm(uint32_t ticks)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    pit_counts_left = ticks * (MAX_FREQ_PIT / pit_hz);
+    pit_armed = 1;
+    pit_load_next();
+    restore_flags(flags);
+}
+
+/*
+ * pit_disarm
+ *   DESCRIPTION: Drops the armed deadline and stops the running count. Setting
+ *                mode 0 again halts channel 0 until a new count is written
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Drives OUT low, so pit_handler ignores an interrupt the old
+ *                 count already raised
+ */
+void pit_disarm(void)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    pit_armed = 0;
+    pit_counts_left = 0;
+    outb(MODE_0, COMMAND_RGSTR_PIT);
+    restore_flags(flags);
+}
+
+/*
+ * pit_is_armed
+ *   DESCRIPTION: Checks whether a deadline is armed
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if armed, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t pit_is_armed(void)
+{
+    return pit_armed;
+}
+
 /*
  * pit_handler
  *   DESCRIPTION: Handle PIT interrupts (for round-robin scheduling)
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Schedule processes
+ *   SIDE EFFECTS: Preempts the current process when its time slice deadline passes,
+ *                 interrupts from an earlier arm are ignored
  */
 void pit_handler()
 {
   send_eoi(IRQ_PIT);
-  schedule();
+  pit_interrupts++;
+
+  if(!pit_armed)
+    return;
+
+  /* OUT is only high once the count loaded by the current arm runs out,
+   * an interrupt left pending by a count since replaced finds it low
+   */
+  if(!(pit_read_status() & PIT_STATUS_OUT))
+    return;
+
+  if(pit_counts_left > 0) {
+    pit_load_next();
+    return;
+  }
+
+  pit_armed = 0;
+  sched_tick();
 }
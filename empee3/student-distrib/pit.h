@@ -17,8 +17,31 @@
 #define MASK_FREQ           0xFF
 #define MODE_3              0x36
 #define MODE_2              0x34
-#define COUNTER_DIVIDER     40
+#define MODE_0              0x30    /* channel 0, low then high byte, interrupt on terminal count */
+#define READ_BACK_0_PIT     0xE2    /* read-back, latch the status of channel 0 only */
+#define PIT_STATUS_OUT      0x80    /* status: OUT pin is high */
+#define PIT_STATUS_NULL     0x40    /* status: the new count is not loaded yet */
+#define PIT_MAX_COUNT       0xFFFF
+
+/* Default scheduler tick rate (pit_hz), time slices are counted in ticks */
+#define PIT_HZ              40
+#define PIT_HZ_MIN          1
+#define PIT_HZ_MAX          10000
+/* Length of the time stamp counter measurement in pit_init */
+#define PIT_CALIBRATE_MS    10
+
+extern uint32_t tsc_per_ms;
+extern uint32_t pit_interrupts;
+extern uint32_t pit_hz;
 
 extern void pit_init();
 extern void pit_handler();
+/* Sets pit_hz, returns -1 if out of range */
+extern int32_t pit_set_hz(uint32_t hz);
+/* Interrupts into sched_tick ticks from now */
+extern void pit_arm(uint32_t ticks);
+/* Cancels the armed deadline */
+extern void pit_disarm(void);
+/* Returns 1 if a deadline is armed */
+extern int32_t pit_is_armed(void);
 #endif
@@ -0,0 +1,220 @@
+#include "syscalls.h"
+#include "stats.h"
+#include "fpu.h"
+
+pcb_t* pcb_arr[MAX_PIDS];
+uint32_t exec_esp[MAX_PIDS];
+uint32_t nr_tasks;
+
+/* One bit per pid, set when taken */
+static uint32_t pid_bitmap[PID_BITMAP_WORDS];
+/* Where the search for the next child pid starts */
+static uint32_t pid_hint;
+/* Zombies whose parent halted before waiting for them */
+static uint32_t orphan_zombies;
+
+/*
+ * pid_init
+ *   DESCRIPTION: Marks every pid free
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Resets the pid bitmap and registers the task counter
+ */
+void pid_init(void) {
+    uint32_t i;
+
+    for(i = 0; i < PID_BITMAP_WORDS; i++)
+        pid_bitmap[i] = 0;
+    pid_hint = NUM_ROOT_PIDS;
+    nr_tasks = 0;
+
+    stats_register("tasks", &nr_tasks);
+}
+
+/*
+ * pid_alloc
+ *   DESCRIPTION: Hands out a free terminal shell pid if there is one, otherwise
+ *                the first free pid at or after the hint. Whole words of taken
+ *                pids are skipped, and the hint moves past the new pid so
+ *                pids are not reused right away
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the pid, NO_PID if every pid is taken
+ *   SIDE EFFECTS: Marks the pid taken
+ */
+int32_t pid_alloc(void) {
+    uint32_t pid, i;
+
+    for(pid = 0; pid < NUM_ROOT_PIDS; pid++) {
+        if(!pid_in_use(pid))
+            break;
+    }
+
+    if(pid == NUM_ROOT_PIDS) {
+        for(i = 0; i < MAX_PIDS - NUM_ROOT_PIDS; i++) {
+            pid = pid_hint + i;
+            if(pid >= MAX_PIDS)
+                pid -= MAX_PIDS - NUM_ROOT_PIDS;
+
+            /* Skip to the next word if this one is full */
+            if((pid % 32 == 0) && (pid_bitmap[pid / 32] == 0xFFFFFFFF) &&
+               (i + 31 < MAX_PIDS - NUM_ROOT_PIDS)) {
+                i += 31;
+                continue;
+            }
+            if(!pid_in_use(pid))
+                break;
+        }
+        if(i >= MAX_PIDS - NUM_ROOT_PIDS)
+            return NO_PID;
+
+        pid_hint = (pid + 1 < MAX_PIDS) ? pid + 1 : NUM_ROOT_PIDS;
+    }
+
+    pid_bitmap[pid / 32] |= 1 << (pid % 32);
+    nr_tasks++;
+    return pid;
+}
+
+/*
+ * pid_free
+ *   DESCRIPTION: Returns a pid to the bitmap
+ *   INPUTS: pid - pid from pid_alloc
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Clears the pid's bit, free pids are ignored
+ */
+void pid_free(uint32_t pid) {
+    if((pid >= MAX_PIDS) || !pid_in_use(pid))
+        return;
+
+    pid_bitmap[pid / 32] &= ~(1 << (pid % 32));
+    nr_tasks--;
+}
+
+/*
+ * pid_in_use
+ *   DESCRIPTION: Checks whether a pid is taken
+ *   INPUTS: pid - pid to check
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if taken, 0 if free (or out of range)
+ *   SIDE EFFECTS: none
+ */
+int32_t pid_in_use(uint32_t pid) {
+    if(pid >= MAX_PIDS)
+        return 0;
+
+    return (pid_bitmap[pid / 32] >> (pid % 32)) & 1;
+}
+
+/*
+ * pid_claim
+ *   DESCRIPTION: Takes a specific pid, for the terminal shells started at boot
+ *   INPUTS: pid - pid to take
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the pid is taken or out of range
+ *   SIDE EFFECTS: Marks the pid taken
+ */
+int32_t pid_claim(uint32_t pid) {
+    if((pid >= MAX_PIDS) || pid_in_use(pid))
+        return -1;
+
+    pid_bitmap[pid / 32] |= 1 << (pid % 32);
+    nr_tasks++;
+    return 0;
+}
+
+/*
+ * task_free
+ *   DESCRIPTION: Gives back everything a task holds: its file objects, its
+ *                FPU state, its address space, its kernel stack, its PCB and its pid
+ *   INPUTS: pcb - task that is not running (a zombie, or a fork that failed)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Clears the task's pcb_arr slot
+ */
+void task_free(pcb_t* pcb) {
+    uint32_t fd;
+
+    for(fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        if((pcb->fd_arr[fd] != NULL) && (pcb->fd_arr[fd]->fops == (int32_t*) file_fops))
+            fs_inode_put(pcb->fd_arr[fd]->inode_num, 0);
+        kmem_cache_free(&file_cache, pcb->fd_arr[fd]);
+    }
+    fpu_release(pcb);
+    free_user_pages(pcb);
+    frame_free_run(pcb->kstack, KSTACK_FRAMES);
+
+    if(pcb_arr[pcb->pid] == pcb)
+        pcb_arr[pcb->pid] = NULL;
+    pid_free(pcb->pid);
+    kmem_cache_free(&pcb_cache, pcb);
+}
+
+/*
+ * task_zombie
+ *   DESCRIPTION: Marks a halting forked task as exited. Its parent frees it in
+ *                wait, a task without a parent is freed by the scheduler
+ *   INPUTS: pcb    - forked task that halts
+ *           status - value its parent's wait reports
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Makes a parent blocked in wait runnable
+ */
+void task_zombie(pcb_t* pcb, int32_t status) {
+    pcb->exit_status = status;
+    pcb->state = TASK_ZOMBIE;
+
+    if(pcb->parent == NULL)
+        orphan_zombies++;
+    else if(pcb->parent->state == TASK_IN_WAIT)
+        task_wake(pcb->parent);
+}
+
+/*
+ * task_disown_children
+ *   DESCRIPTION: Detaches the forked children of a halting task. Children that
+ *                already exited are freed, the others run on without a parent
+ *   INPUTS: pcb - halting task
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Clears the children's parent pointers
+ */
+void task_disown_children(pcb_t* pcb) {
+    uint32_t pid;
+    pcb_t* child;
+
+    for(pid = 0; pid < MAX_PIDS; pid++) {
+        child = pcb_arr[pid];
+        if((child == NULL) || (child->parent != pcb) || !child->forked)
+            continue;
+        if(child->state == TASK_ZOMBIE)
+            task_free(child);
+        else
+            child->parent = NULL;
+    }
+}
+
+/*
+ * task_reap_orphans
+ *   DESCRIPTION: Frees zombies that have no parent. A zombie is skipped while
+ *                it is still the current task, it is freed from another task's
+ *                stack on a later call
+ *   INPUTS: cur - current task
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: See task_free
+ */
+void task_reap_orphans(pcb_t* cur) {
+    uint32_t pid;
+    pcb_t* task;
+
+    for(pid = 0; (pid < MAX_PIDS) && (orphan_zombies > 0); pid++) {
+        task = pcb_arr[pid];
+        if((task == NULL) || (task == cur) || (task->state != TASK_ZOMBIE) || (task->parent != NULL))
+            continue;
+        task_free(task);
+        orphan_zombies--;
+    }
+}
@@ -4,12 +4,30 @@
 #include "filesys.h"
 
 #define MAX_OPEN_FILES          8
-#define MAX_RUNNING_PROCESSES   6
 #define USED                    1
 #define NOT_USED                0
 
+/* Process ids, handed out from a bitmap. Pids 0 to 2 belong to the shells
+ * of the three terminals and are always taken first when free
+ */
+#define MAX_PIDS              256
+#define PID_BITMAP_WORDS      (MAX_PIDS / 32)
+#define NUM_ROOT_PIDS           3
+#define NO_PID                 -1
+
 #define BUFFER_SIZE   128
 
+/* Different files one process can have mmapped */
+#define MAX_MMAP_FILES          8
+
+/* Task states, the scheduler picks TASK_READY tasks from its run queue */
+#define TASK_RUNNING            0   /* on the processor */
+#define TASK_READY              1   /* in the run queue */
+#define TASK_IN_EXECUTE         2   /* parent blocked until its execute child halts */
+#define TASK_IN_WAIT            3   /* blocked in wait until a forked child halts */
+#define TASK_SLEEPING           4   /* blocked on a wait queue (sleep_on) */
+#define TASK_ZOMBIE             5   /* forked child that halted, freed by wait */
+
 /* Taken from lecture notes */
 typedef struct file_object {
     int32_t *fops;
@@ -23,20 +41,77 @@ extern file_t fd_arr[MAX_OPEN_FILES];
 /*
  * pid - process id of the current process pcb
  * on_term - current terminal that process is on
- * fd_arr[MAX_OPEN_FILES] - fd array for each process
- * kernel_stack - esp of pcb
- * kernel_base - ebp of pcb
+ * fd_arr[MAX_OPEN_FILES] - file objects (from the file cache) of each fd, NULL if unused
+ * kernel_stack - esp saved by switch_to while the task is switched out
  * parent - parent process
  * buffCopyArg - arguments of command
+ * mmap_next - next free page of the process' mmap region
+ * mmap_files - number of entries in mmap_inodes
+ * mmap_inodes - inodes mapped into the mmap region, each pinned once (see fs_inode_get)
+ * image_inode - inode of the executable backing the program image
+ * image_size - size of the program image in bytes
+ * pages_loaded - image pages mapped in by the page fault handler
+ * image_slot - slot of the shared image cache backing the program image
+ * page_dir - page directory of the process (frame from the frame allocator)
+ * brk - end of the heap, heap pages from USER_HEAP_START up to it fault in zero filled
+ * kstack - base of the 8-kB kernel stack, whose first word points back at the PCB
+ * state - TASK_* state
+ * forked - 1 if created by fork, its parent collects it with wait
+ * exit_status - halt status of a zombie, EXCEP_RET if killed by an exception
+ * run_next - next task in the run queue
+ * wait_next - next task in the wait queue this one sleeps on
+ * fpu_state - saved FPU registers (see fpu.c), NULL until the task uses the FPU
  */
 typedef struct pcb {
     uint32_t pid;
     uint32_t on_term;
-    file_t fd_arr[MAX_OPEN_FILES];
+    file_t* fd_arr[MAX_OPEN_FILES];
     uint32_t kernel_stack;
-    uint32_t kernel_base;
     struct pcb* parent;
     uint8_t buffCopyArg[BUFFER_SIZE];
+    uint32_t mmap_next;
+    uint32_t mmap_files;
+    uint32_t mmap_inodes[MAX_MMAP_FILES];
+    uint32_t image_inode;
+    uint32_t image_size;
+    uint32_t pages_loaded;
+    int32_t image_slot;
+    uint32_t* page_dir;
+    uint32_t brk;
+    uint32_t kstack;
+    uint32_t state;
+    uint32_t forked;
+    int32_t exit_status;
+    struct pcb* run_next;
+    struct pcb* wait_next;
+    void* fpu_state;
 } pcb_t;
 
+/* PCB of every pid, NULL when the pid has no task */
+extern pcb_t* pcb_arr[MAX_PIDS];
+/* Stack saved by context_setup for exec_return, per pid */
+extern uint32_t exec_esp[MAX_PIDS];
+/* Number of pids in use */
+extern uint32_t nr_tasks;
+
+/* Clears the pid bitmap */
+extern void pid_init(void);
+/* Takes a free pid, NO_PID when all are in use */
+extern int32_t pid_alloc(void);
+/* Returns a pid to the bitmap */
+extern void pid_free(uint32_t pid);
+/* Returns 1 if the pid is taken */
+extern int32_t pid_in_use(uint32_t pid);
+/* Takes a specific free pid, returns -1 if it is taken */
+extern int32_t pid_claim(uint32_t pid);
+
+/* Frees a task that is not running: PCB, kernel stack, address space and pid */
+extern void task_free(pcb_t* pcb);
+/* Turns a halting forked task into a zombie and wakes its waiting parent */
+extern void task_zombie(pcb_t* pcb, int32_t status);
+/* Detaches the forked children of a halting task, freeing the zombies */
+extern void task_disown_children(pcb_t* pcb);
+/* Frees zombies nobody will wait for, except the current task */
+extern void task_reap_orphans(pcb_t* cur);
+
 #endif
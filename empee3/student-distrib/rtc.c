@@ -2,8 +2,9 @@
 
 extern void test_interrupts();
 
-// We have to use a flag to see if the current interrupt is skipped
-volatile int8_t interrupt_happening = 0;
+// Counts RTC interrupts, RTC_read sleeps on rtc_queue until it changes
+volatile uint32_t rtc_ticks = 0;
+static wait_queue_t rtc_queue;
 
 /*
  * RTC_init
@@ -44,12 +45,11 @@ void RTC_init(){
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: prints garbage to the screen
+ *   SIDE EFFECTS: Wakes the tasks blocked in RTC_read
  */
 extern void RTC_handler(){
-    if(interrupt_happening == 0){
-    	interrupt_happening = 1;
-    }
+    rtc_ticks++;
+    wake_up(&rtc_queue);
     disable_irq(RTC_IRQ_LINE);  // disabling IRQ line to set up critical section
     //test_interrupts();          // printing out the garbage values
 
@@ -103,7 +103,7 @@ void NMI_disable(void){
 int32_t RTC_open(int32_t fd)
 {
     pcb_t* pcb_ptr = get_pcb();
-    pcb_ptr->fd_arr[fd].inode_num = 0;
+    pcb_ptr->fd_arr[fd]->inode_num = 0;
 
     RTC_init();
     return 0;
@@ -123,22 +123,26 @@ int32_t RTC_close(){
 
 /*
 * RTC_read()
-*Description: This function probably does nothing, unless RTC us virtualized , return 0
+*Description: This function waits for the next RTC interrupt, return 0
 *INPUTS: - fd: file descriptor
 			 - buf: unused
 			 - nbytes:bytes to write
 *RETURN VALUE: 0
-*SIDE EFFECTS: -
+*SIDE EFFECTS: Sleeps on the RTC wait queue, other tasks run meanwhile
 */
 int32_t RTC_read()
 {
-    interrupt_happening=0;
-    // do nothing while there is no interrupt
-    while(!interrupt_happening)
-    {
+    uint32_t flags;
+    uint32_t start;
 
+    cli_and_save(flags);
+    start = rtc_ticks;
+    // sleep while there is no interrupt, RTC_handler wakes us
+    while(rtc_ticks == start)
+    {
+        sleep_on(&rtc_queue);
     }
-    interrupt_happening=0;
+    restore_flags(flags);
 
     return 0;
 }
@@ -44,7 +44,7 @@ void RTC_init();
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: prints garbage to the screen
+ *   SIDE EFFECTS: Wakes the tasks blocked in RTC_read
  */
 extern void RTC_handler();
 
@@ -89,12 +89,12 @@ void NMI_disable(void);
   extern int32_t RTC_close();
   /*
    * RTC_read()
-   *Description: This function probably does nothing, unless RTC us virtualized , return 0
+   *Description: This function waits for the next RTC interrupt, return 0
    *INPUTS: - fd: file descriptor
             - buf: unused
             - nbytes:bytes to write
    *RETURN VALUE: 0
-   *SIDE EFFECTS: -
+   *SIDE EFFECTS: Sleeps on the RTC wait queue, other tasks run meanwhile
    */
    extern int32_t RTC_read();
 
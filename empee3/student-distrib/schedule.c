@@ -1,53 +1,424 @@
 #include "schedule.h"
+#include "pit.h"
+#include "fpu.h"
 
-uint8_t cur_pid = 0;    //0, 1, 2 reserved for terminal shells
-uint8_t term_counter = 0;
+uint32_t cur_pid = 0;    //0, 1, 2 reserved for terminal shells
 
-int32_t schedule(){
-    pcb_t* cur_task = get_pcb();
+/* Run queue of TASK_READY tasks, linked through run_next, taken from the head */
+static pcb_t* run_head;
+static pcb_t* run_tail;
+
+/* Runs when no task is ready, never queued */
+static pcb_t* idle_task;
+/* Idle time not yet counted in idle_ms, in time stamp counter cycles */
+static uint32_t idle_cycles;
+
+/* Time slice in PIT ticks, tunable as "sched_quantum" */
+uint32_t sched_quantum;
+
+uint32_t context_switches;
+uint32_t preemptions;
+uint32_t idle_ms;
+uint32_t idle_entries;
+/* Cycles from just before switch_to in the old task to just after it in the
+ * new one, for the last switch and the cheapest so far. Not counted for a
+ * task's first switch, which returns into its entry code instead
+ */
+uint32_t switch_cycles;
+uint32_t switch_cycles_min;
+static uint32_t switch_start;
 
-    /* Save ebp to use as reference */
-    asm volatile("movl %%esp, %0" : "=r"(cur_task->kernel_stack));
-    asm volatile("movl %%ebp, %0" : "=r"(cur_task->kernel_base));
+/*
+ * idle_loop
+ *   DESCRIPTION: Body of the idle task: halts until an interrupt makes a task
+ *                ready, then switches to it. Time spent halted is added to idle_ms
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none (never returns)
+ *   SIDE EFFECTS: none
+ */
+static void idle_loop(void) {
+    uint32_t start_lo, start_hi, end_lo, end_hi, ms;
 
-    /* Determine next process */
-    term_counter = (term_counter + 1) % MAX_TERMS;
-    cur_pid = terminals[term_counter].active_pid;
+    while(1) {
+        cli();
+        if(run_head != NULL) {
+            schedule();
+            continue;
+        }
+
+        /* sti takes effect after hlt starts, no wake up is missed */
+        asm volatile("rdtsc" : "=a"(start_lo), "=d"(start_hi));
+        asm volatile("sti; hlt");
+        cli();
+        asm volatile("rdtsc" : "=a"(end_lo), "=d"(end_hi));
 
-    /* Launches shell 1 (terminal 1), shell 2 (terminal 2) if not launched  */
-    if((pid_arr[SECOND_SHELL] == NOT_USED) || (pid_arr[THIRD_SHELL] == NOT_USED)) {
-        do_execute((const uint8_t*) "shell");
+        /* 64-bit cycle count divided by tsc_per_ms (quotient fits unless idle for 49 days) */
+        end_hi -= start_hi + (end_lo < start_lo);
+        end_lo -= start_lo;
+        if((tsc_per_ms == 0) || (end_hi >= tsc_per_ms))
+            continue;
+        asm volatile("divl %4" : "=a"(ms), "=d"(end_lo) : "a"(end_lo), "d"(end_hi), "rm"(tsc_per_ms));
+        idle_cycles += end_lo;
+        if(idle_cycles >= tsc_per_ms) {
+            idle_cycles -= tsc_per_ms;
+            ms++;
+        }
+        idle_ms += ms;
     }
+}
 
-    /* Update paging */
-    // Map 0x08000000 to 0x08400000 (128 to 132-MB) to (8MB + PARENT_PID * 4MB)
-    page_directory[32] = (uint32_t) (FIRST_USER+(cur_pid)*FOUR_MB) | 0x87;
-    flushTLB();
-
-    /*
-    If we use vidmap, and displayed terminal isn't the current terminal, write to backing page
-    otherwise, we do normal video paging setup and display terminal
-    */
-    if (terminals[cur_task->on_term].vid_map_flag == 1){
-        if (cur_task->on_term != curr_terminal){
-            user_vidmem_page_table[0] = (uint32_t) (VIDEO_MEMORY + ((cur_task->on_term)+1) * (FOUR_KB)) | 0x7;
-            flushTLB();
+/*
+ * sched_init
+ *   DESCRIPTION: Registers the scheduler counters, creates the idle task and
+ *                queues the shells of terminals 1 and 2, they execute "shell"
+ *                the first time the scheduler picks them. The terminal 0 shell
+ *                is executed by the boot code
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Takes pids SECOND_SHELL and THIRD_SHELL
+ */
+void sched_init(void) {
+    uint32_t pid;
+
+    run_head = NULL;
+    run_tail = NULL;
+    context_switches = 0;
+    preemptions = 0;
+    idle_ms = 0;
+    idle_entries = 0;
+    idle_cycles = 0;
+    switch_cycles = 0;
+    switch_cycles_min = 0;
+    sched_quantum = SCHED_QUANTUM;
+    stats_register_tunable("sched_quantum", &sched_quantum, sched_set_quantum);
+    stats_register("context_switches", &context_switches);
+    stats_register("preemptions", &preemptions);
+    stats_register("idle_ms", &idle_ms);
+    stats_register("idle_entries", &idle_entries);
+    stats_register("switch_cycles", &switch_cycles);
+    stats_register("switch_cycles_min", &switch_cycles_min);
+
+    /* Like the boot PCB, the idle task has pid 0 and terminal 0 but no pcb_arr slot */
+    if((idle_task = kmem_cache_alloc(&pcb_cache)) != NULL) {
+        memset((void*) idle_task, 0, sizeof(pcb_t));
+        if((idle_task->kstack = frame_alloc_run(KSTACK_FRAMES)) == NO_FRAME) {
+            kmem_cache_free(&pcb_cache, idle_task);
+            idle_task = NULL;
         }
-        else{
-            user_vidmem_page_table[0] = (uint32_t) VIDEO_MEMORY | 0x7;
-            flushTLB();
+    }
+    if(idle_task != NULL) {
+        *(pcb_t**) idle_task->kstack = idle_task;
+        *(uint32_t*) (idle_task->kstack + EIGHT_KB - sizeof(uint32_t)) = 0;
+        task_stack_init(idle_task, idle_task->kstack + EIGHT_KB - sizeof(uint32_t), idle_loop);
+    }
+
+    for(pid = SECOND_SHELL; pid <= THIRD_SHELL; pid++)
+        sched_spawn_shell(pid);
+}
+
+/*
+ * sched_set_quantum
+ *   DESCRIPTION: Changes the time slice, from the next slice on
+ *   INPUTS: ticks - pit_hz ticks, 1 to SCHED_QUANTUM_MAX
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if ticks is out of range
+ *   SIDE EFFECTS: none
+ */
+int32_t sched_set_quantum(uint32_t ticks) {
+    if((ticks == 0) || (ticks > SCHED_QUANTUM_MAX))
+        return -1;
+
+    sched_quantum = ticks;
+    return 0;
+}
+
+/*
+ * root_shell_start
+ *   DESCRIPTION: First code of a terminal shell queued by sched_init, runs on
+ *                the shell's own kernel stack. Gives its pid back like a
+ *                halting root shell does, execute takes it again
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none (execute does not return for a root shell)
+ *   SIDE EFFECTS: Executes "shell"
+ */
+static void root_shell_start(void) {
+    cli();
+    pid_free(get_pcb()->pid);
+    do_execute((const uint8_t*) "shell");
+}
+
+/*
+ * sched_spawn_shell
+ *   DESCRIPTION: Creates a task for a terminal shell and queues it
+ *   INPUTS: pid - shell pid (SECOND_SHELL or THIRD_SHELL)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the pid is taken or memory ran out
+ *   SIDE EFFECTS: Takes the pid, a PCB and a kernel stack
+ */
+int32_t sched_spawn_shell(uint32_t pid) {
+    pcb_t* pcb;
+
+    if(pid_claim(pid) == -1)
+        return -1;
+    if((pcb = kmem_cache_alloc(&pcb_cache)) == NULL) {
+        pid_free(pid);
+        return -1;
+    }
+
+    memset((void*) pcb, 0, sizeof(pcb_t));
+    pcb->pid = pid;
+    pcb->on_term = pid;
+    if((pcb->kstack = frame_alloc_run(KSTACK_FRAMES)) == NO_FRAME) {
+        kmem_cache_free(&pcb_cache, pcb);
+        pid_free(pid);
+        return -1;
+    }
+
+    /* root_shell_start never returns, its return address is left 0 */
+    *(pcb_t**) pcb->kstack = pcb;
+    *(uint32_t*) (pcb->kstack + EIGHT_KB - sizeof(uint32_t)) = 0;
+    task_stack_init(pcb, pcb->kstack + EIGHT_KB - sizeof(uint32_t), root_shell_start);
+
+    pcb_arr[pid] = pcb;
+    sched_add(pcb);
+    return 0;
+}
+
+/*
+ * task_stack_init
+ *   DESCRIPTION: Builds the frame switch_to pops on a task's kernel stack, so
+ *                that the first switch to the task returns into entry
+ *   INPUTS: pcb   - task that has never run
+ *           top   - address the frame is built below (the stack above it is
+ *                   what entry starts with)
+ *           entry - code the task starts in
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Sets kernel_stack
+ */
+void task_stack_init(pcb_t* pcb, uint32_t top, void (*entry)(void)) {
+    uint32_t* frame = (uint32_t*) top;
+
+    /* Return address, then ebp, ebx, esi and edi, all zero */
+    frame[-1] = (uint32_t) entry;
+    frame[-2] = 0;
+    frame[-3] = 0;
+    frame[-4] = 0;
+    frame[-5] = 0;
+    pcb->kernel_stack = top - 5 * sizeof(uint32_t);
+}
+
+/*
+ * sched_add
+ *   DESCRIPTION: Makes a task that is not running ready and queues it
+ *   INPUTS: pcb - task to queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Appends the task to the run queue. The running task gets
+ *                 a time slice deadline now that another task waits
+ */
+void sched_add(pcb_t* pcb) {
+    pcb_t* cur_task = get_pcb();
+
+    pcb->state = TASK_READY;
+    pcb->run_next = NULL;
+    if(run_tail == NULL)
+        run_head = pcb;
+    else
+        run_tail->run_next = pcb;
+    run_tail = pcb;
+
+    /* The boot stack is never preempted */
+    if((cur_task != idle_task) && (cur_task != pcb) && (cur_task->kstack != 0) && !pit_is_armed())
+        pit_arm(sched_quantum);
+}
+
+/*
+ * task_wake
+ *   DESCRIPTION: Makes a blocked task runnable, may be called from an
+ *                interrupt handler
+ *   INPUTS: pcb - task to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Queues the task, unless it is the interrupted task itself
+ *                 (it is still on the processor and just keeps running)
+ */
+void task_wake(pcb_t* pcb) {
+    if((pcb->state == TASK_RUNNING) || (pcb->state == TASK_READY) || (pcb->state == TASK_ZOMBIE))
+        return;
+
+    if(pcb == get_pcb())
+        pcb->state = TASK_RUNNING;
+    else
+        sched_add(pcb);
+}
+
+/*
+ * sched_block
+ *   DESCRIPTION: Gives the processor away after the current task blocked (its
+ *                state was changed by the caller, with interrupts off) and
+ *                returns once it is running again. Only the boot stack, which
+ *                the scheduler does not switch away from, halts here
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Returns with interrupts off
+ */
+void sched_block(void) {
+    pcb_t* cur_task = get_pcb();
+
+    while(cur_task->state != TASK_RUNNING) {
+        schedule();
+        if(cur_task->state != TASK_RUNNING) {
+            sti();
+            asm volatile("hlt");
+            cli();
         }
     }
+}
+
+/*
+ * sleep_on
+ *   DESCRIPTION: Blocks the current task on a wait queue until wake_up. Called
+ *                with interrupts off after checking the condition waited for,
+ *                the caller checks it again when this returns
+ *   INPUTS: queue - queue to sleep on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Other tasks run meanwhile, returns with interrupts off
+ */
+void sleep_on(wait_queue_t* queue) {
+    pcb_t* cur_task = get_pcb();
+
+    cur_task->state = TASK_SLEEPING;
+    cur_task->wait_next = NULL;
+    if(queue->tail == NULL)
+        queue->head = cur_task;
+    else
+        queue->tail->wait_next = cur_task;
+    queue->tail = cur_task;
+
+    sched_block();
+}
+
+/*
+ * wake_up
+ *   DESCRIPTION: Wakes every task sleeping on a wait queue
+ *   INPUTS: queue - queue to empty
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Queues the tasks to run, see task_wake
+ */
+void wake_up(wait_queue_t* queue) {
+    uint32_t flags;
+    pcb_t* task;
+
+    cli_and_save(flags);
+    while((task = queue->head) != NULL) {
+        queue->head = task->wait_next;
+        task->wait_next = NULL;
+        task_wake(task);
+    }
+    queue->tail = NULL;
+    restore_flags(flags);
+}
+
+/*
+ * sched_tick
+ *   DESCRIPTION: Called by the PIT when the running task's time slice deadline
+ *                passes, preempts it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: May switch tasks
+ */
+void sched_tick(void) {
+    pcb_t* cur_task = get_pcb();
+
+    /* Deadlines passing on the boot stack, before the first shell runs */
+    if(cur_task->kstack == 0)
+        return;
+
+    if((cur_task->state == TASK_RUNNING) && (cur_task != idle_task) && (run_head != NULL))
+        preemptions++;
+    schedule();
+}
+
+/*
+ * schedule
+ *   DESCRIPTION: Switches to the task at the head of the run queue. A running
+ *                task goes to the back of the queue, a task that blocked
+ *                (state already changed by the caller) is just left. With no
+ *                task ready, a running task keeps the processor and a blocked
+ *                one gives it to the idle task
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: Arms the PIT for the next task's time slice only if another
+ *                 task is waiting, the processor takes no timer interrupts
+ *                 otherwise
+ */
+int32_t schedule(){
+    pcb_t* cur_task = get_pcb();
+    pcb_t* next_task;
+    uint32_t now, hi;
+
+    /* The boot stack is not a task (kernel tests sleeping in a driver just halt) */
+    if(cur_task->kstack == 0)
+        return 0;
+
+    /* Forked tasks that halted without a parent are freed here */
+    task_reap_orphans(cur_task);
+
+    /* Determine next process, the head of the run queue */
+    if(run_head != NULL) {
+        next_task = run_head;
+        run_head = next_task->run_next;
+        if(run_head == NULL)
+            run_tail = NULL;
+    } else if((cur_task->state == TASK_RUNNING) || (idle_task == NULL)) {
+        next_task = cur_task;
+    } else {
+        next_task = idle_task;
+    }
+
+    if((cur_task->state == TASK_RUNNING) && (cur_task != idle_task) && (next_task != cur_task))
+        sched_add(cur_task);
+    next_task->state = TASK_RUNNING;
+
+    /* Time slice deadline, only needed if someone else waits */
+    pit_disarm();
+    if((next_task != idle_task) && (run_head != NULL))
+        pit_arm(sched_quantum);
+
+    if(next_task == cur_task)
+        return 0;
+    cur_pid = next_task->pid;
+    context_switches++;
+    if(next_task == idle_task)
+        idle_entries++;
+
+    /* Update paging */
+    // Load the next process' page directory, its vidmap page already points
+    // at the screen or at its terminal's backing page (see switch_terminal)
+    map_user_process(next_task);
 
     /* Set tss.esp0 to the bottom of new task's kernel stack */
-    uint32_t next_kstack = (EIGHT_MB) - (cur_pid * EIGHT_KB);
-    tss.esp0 = next_kstack;
+    tss.esp0 = next_task->kstack + EIGHT_KB;
+
+    /* FPU registers stay loaded, the next task traps if they are not its own */
+    fpu_switch(next_task);
 
-    /* Restore ebp of next process */
-    pcb_t* next_task = (pcb_t*) (next_kstack - EIGHT_KB);
-    asm volatile("movl %0, %%esp" : :"r"(next_task->kernel_stack));
-    asm volatile("popl %eax");
-    asm volatile("movl %0, %%ebp" : :"r"(next_task->kernel_base));
+    /* Returns when another task's schedule switches back to this one */
+    asm volatile("rdtsc" : "=a"(switch_start), "=d"(hi));
+    switch_to(&cur_task->kernel_stack, next_task->kernel_stack);
+    asm volatile("rdtsc" : "=a"(now), "=d"(hi));
 
+    switch_cycles = now - switch_start;
+    if((switch_cycles_min == 0) || (switch_cycles < switch_cycles_min))
+        switch_cycles_min = switch_cycles;
     return 0;
 }
@@ -1,14 +1,60 @@
 #ifndef SCHEDULE_H_
 #define SCHEDULE_H_
 
+#include "types.h"
+
+struct pcb;
+
+/* Tasks sleeping until an event, linked through their wait_next field.
+ * Defined ahead of the other headers, terminal_t embeds one
+ */
+typedef struct wait_queue {
+    struct pcb* head;
+    struct pcb* tail;
+} wait_queue_t;
+
 #include "syscalls.h"
 
 #define FIRST_SHELL    0
 #define SECOND_SHELL   1
 #define THIRD_SHELL    2
 
-extern uint8_t cur_pid;         //var to keep track of current process
-extern uint8_t term_counter;    //var to keep track of next terminal 
+/* Default time slice (sched_quantum), in pit_hz ticks a task runs before it
+ * is preempted by a waiting task
+ */
+#define SCHED_QUANTUM       2
+#define SCHED_QUANTUM_MAX   1000
+
+extern uint32_t cur_pid;        //var to keep track of current process
+extern uint32_t sched_quantum;  //time slice in ticks
+extern uint32_t context_switches;
+extern uint32_t preemptions;
+extern uint32_t idle_ms;        //time the idle task spent halted
+extern uint32_t idle_entries;   //switches to the idle task
+extern uint32_t switch_cycles;  //cost of the last switch_to, in TSC cycles
+extern uint32_t switch_cycles_min;
 
+/* Registers the counters, creates the idle task and queues the shells of terminals 1 and 2 */
+void sched_init(void);
+/* Sets sched_quantum, returns -1 if out of range */
+int32_t sched_set_quantum(uint32_t ticks);
+/* Creates and queues the task of a terminal shell */
+int32_t sched_spawn_shell(uint32_t pid);
+/* Makes the first switch to a new task return into entry */
+void task_stack_init(struct pcb* pcb, uint32_t top, void (*entry)(void));
+/* Queues a task that is ready to run */
+void sched_add(struct pcb* pcb);
+/* Makes a blocked task runnable */
+void task_wake(struct pcb* pcb);
+/* Preempts the running task, its time slice deadline passed */
+void sched_tick(void);
+/* Runs other tasks until the current one, which just blocked, is woken */
+void sched_block(void);
+/* Blocks the current task on a queue until wake_up (interrupts off) */
+void sleep_on(wait_queue_t* queue);
+/* Wakes every task sleeping on a queue, may be called from an interrupt handler */
+void wake_up(wait_queue_t* queue);
 int32_t schedule();
+/* Saves the callee-saved registers and esp to *prev_esp, resumes next_esp (switch_asm.S) */
+extern void switch_to(uint32_t* prev_esp, uint32_t next_esp);
 #endif
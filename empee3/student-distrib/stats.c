@@ -0,0 +1,297 @@
+#include "stats.h"
+#include "syscalls.h"
+
+static stat_entry_t stats[MAX_STATS];
+static uint32_t num_stats = 0;
+static int8_t stats_buf[STATS_BUF_SIZE];
+
+/*
+ * stats_register
+ *   DESCRIPTION: Adds a named counter to the stats file
+ *   INPUTS: name    - Label printed in front of the value
+ *           counter - Pointer to the counter to report
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the table is full
+ *   SIDE EFFECTS: Counter shows up in every later read of the stats file
+ */
+int32_t stats_register(const int8_t* name, volatile uint32_t* counter) {
+    if(num_stats >= MAX_STATS)
+        return -1;
+
+    strncpy(stats[num_stats].name, name, STATS_NAME_LEN - 1);
+    stats[num_stats].name[STATS_NAME_LEN - 1] = '\0';
+    stats[num_stats].counter = counter;
+    stats[num_stats].set = NULL;
+    num_stats++;
+
+    return 0;
+}
+
+/*
+ * stats_register_tunable
+ *   DESCRIPTION: Adds a named value to the stats file that can also be set,
+ *                by writing "name=value" to the file or on the kernel command line
+ *   INPUTS: name    - Label printed in front of the value
+ *           counter - Pointer to the value to report
+ *           set     - Validates and applies a new value, returns 0 or -1
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the table is full
+ *   SIDE EFFECTS: Value shows up in every later read of the stats file
+ */
+int32_t stats_register_tunable(const int8_t* name, volatile uint32_t* counter,
+                               int32_t (*set)(uint32_t value)) {
+    if(stats_register(name, counter) == -1)
+        return -1;
+
+    stats[num_stats - 1].set = set;
+    return 0;
+}
+
+/*
+ * stats_set_pair
+ *   DESCRIPTION: Applies one "name=value" pair
+ *   INPUTS: pair - the pair, NUL terminated
+ *           ignore_unknown - 1 to accept names that are not tunables (kernel
+ *                            command line words meant for someone else)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the pair was rejected
+ *   SIDE EFFECTS: Calls the tunable's set function
+ */
+static int32_t stats_set_pair(int8_t* pair, int32_t ignore_unknown) {
+    uint32_t i, name_len, value = 0;
+    int8_t* digits;
+
+    for(name_len = 0; (pair[name_len] != '\0') && (pair[name_len] != '='); name_len++) {}
+    if(pair[name_len] == '\0')
+        return ignore_unknown ? 0 : -1;
+
+    for(i = 0; i < num_stats; i++) {
+        if((strlen(stats[i].name) == name_len) && (strncmp(stats[i].name, pair, name_len) == 0))
+            break;
+    }
+    if(i == num_stats)
+        return ignore_unknown ? 0 : -1;
+    if(stats[i].set == NULL)
+        return -1;
+
+    digits = pair + name_len + 1;
+    if(*digits == '\0')
+        return -1;
+    for(; *digits != '\0'; digits++) {
+        if((*digits < '0') || (*digits > '9') || (value > 100000000))
+            return -1;
+        value = value * 10 + (*digits - '0');
+    }
+
+    return stats[i].set(value);
+}
+
+/*
+ * stats_set_text
+ *   DESCRIPTION: Applies the "name=value" pairs of a text, separated by
+ *                spaces or new lines
+ *   INPUTS: text - the pairs
+ *           len  - length of text
+ *           ignore_unknown - 1 to skip words that do not name a tunable
+ *   OUTPUTS: none
+ *   RETURN VALUE: Number of pairs rejected
+ *   SIDE EFFECTS: Sets tunables
+ */
+int32_t stats_set_text(const int8_t* text, int32_t len, int32_t ignore_unknown) {
+    int8_t pair[STATS_PAIR_LEN];
+    int32_t i, pair_len = 0, rejected = 0;
+    int8_t c;
+
+    for(i = 0; i <= len; i++) {
+        c = (i < len) ? text[i] : '\0';
+
+        if((c == ' ') || (c == '\n') || (c == '\r') || (c == '\0')) {
+            if(pair_len > 0) {
+                pair[pair_len] = '\0';
+                rejected += (stats_set_pair(pair, ignore_unknown) == -1);
+            }
+            pair_len = 0;
+            if(c == '\0')
+                break;
+            continue;
+        }
+
+        /* Too long to be a tunable, kept short enough to be rejected */
+        if(pair_len < STATS_PAIR_LEN - 1)
+            pair[pair_len++] = c;
+        else
+            pair[0] = '\0';
+    }
+
+    return rejected;
+}
+
+/*
+ * is_stats_file
+ *   DESCRIPTION: Checks whether filename refers to the stats file
+ *   INPUTS: filename - Name of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it is the stats file, else 0
+ *   SIDE EFFECTS: none
+ */
+int32_t is_stats_file(const uint8_t* filename) {
+    return strncmp((const int8_t*) filename, STATS_NAME, FILENAME_LEN) == 0;
+}
+
+/*
+ * stats_format
+ *   DESCRIPTION: Prints every registered counter as "name: value\n" into stats_buf
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: Number of bytes written to stats_buf
+ *   SIDE EFFECTS: Overwrites stats_buf, callers keep interrupts off until they
+ *                 are done with it
+ */
+static int32_t stats_format(void) {
+    int8_t num[STATS_NAME_LEN];
+    uint32_t i;
+    uint32_t len = 0;
+    uint32_t name_len, num_len;
+
+    for(i = 0; i < num_stats; i++) {
+        itoa(*stats[i].counter, num, 10);
+        name_len = strlen(stats[i].name);
+        num_len = strlen(num);
+
+        /* name + ": " + value + "\n" */
+        if(len + name_len + num_len + 3 > STATS_BUF_SIZE)
+            break;
+
+        memcpy(stats_buf + len, stats[i].name, name_len);
+        len += name_len;
+        stats_buf[len++] = ':';
+        stats_buf[len++] = ' ';
+        memcpy(stats_buf + len, num, num_len);
+        len += num_len;
+        stats_buf[len++] = '\n';
+    }
+
+    return len;
+}
+
+/*
+ * stats_open
+ *   DESCRIPTION: Opens the stats file
+ *   INPUTS: filename - Name of the file, fd - file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: Resets the file position
+ */
+int32_t stats_open(const uint8_t* filename, int fd) {
+    pcb_t* pcb_ptr = get_pcb();
+
+    pcb_ptr->fd_arr[fd]->inode_num = 0;
+    pcb_ptr->fd_arr[fd]->fpos = 0;
+
+    return 0;
+}
+
+int32_t stats_close(int32_t fd) {
+    return 0;
+}
+
+/*
+ * stats_read
+ *   DESCRIPTION: Reads a snapshot of the kernel counters as text
+ *   INPUTS: fd - file descriptor, buf - buffer to fill, nbytes - size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: Number of bytes read, 0 at end of file
+ *   SIDE EFFECTS: Advances the file position
+ */
+int32_t stats_read(int32_t fd, void* buf, int32_t nbytes) {
+    pcb_t* pcb_ptr = get_pcb();
+    int32_t fpos = pcb_ptr->fd_arr[fd]->fpos;
+    int32_t len;
+    uint32_t flags;
+
+    /* stats_buf is shared, nobody may reformat it before it is copied out */
+    cli_and_save(flags);
+    len = stats_format();
+    if(fpos >= len) {
+        restore_flags(flags);
+        return 0;
+    }
+
+    if(nbytes > len - fpos)
+        nbytes = len - fpos;
+
+    memcpy(buf, stats_buf + fpos, nbytes);
+    restore_flags(flags);
+    pcb_ptr->fd_arr[fd]->fpos += nbytes;
+
+    return nbytes;
+}
+
+/*
+ * stats_lseek
+ *   DESCRIPTION: Repositions the stats file, SEEK_END is the end of a fresh snapshot
+ *   INPUTS: fd - file descriptor, offset - byte offset, whence - SEEK_SET/CUR/END
+ *   OUTPUTS: none
+ *   RETURN VALUE: new file position, -1 on failure
+ *   SIDE EFFECTS: Modifies the file position
+ */
+int32_t stats_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    uint32_t flags;
+    int32_t len;
+
+    cli_and_save(flags);
+    len = stats_format();
+    restore_flags(flags);
+
+    return fpos_seek(fd, offset, whence, len);
+}
+
+/*
+ * stats_pread
+ *   DESCRIPTION: Reads a snapshot of the counters at offset, ignoring the file position
+ *   INPUTS: fd - file descriptor, buf - buffer to fill, nbytes - size of buf,
+ *           offset - where to start reading
+ *   OUTPUTS: none
+ *   RETURN VALUE: Number of bytes read, 0 at end of file, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t stats_pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset) {
+    uint32_t flags;
+    int32_t len;
+
+    if((nbytes < 0) || (offset < 0))
+        return -1;
+
+    /* Format and copy out in one go, see stats_read */
+    cli_and_save(flags);
+    len = stats_format();
+    if(offset >= len) {
+        nbytes = 0;
+    } else {
+        if(nbytes > len - offset)
+            nbytes = len - offset;
+        memcpy(buf, stats_buf + offset, nbytes);
+    }
+    restore_flags(flags);
+
+    return nbytes;
+}
+
+/*
+ * stats_write
+ *   DESCRIPTION: Sets tunables from "name=value" pairs separated by spaces or
+ *                new lines. Counters are read-only
+ *   INPUTS: fd - file descriptor, buf - the text, nbytes - length of the text
+ *   OUTPUTS: none
+ *   RETURN VALUE: nbytes if every pair was applied, -1 otherwise
+ *   SIDE EFFECTS: Sets tunables
+ */
+int32_t stats_write(int32_t fd, const void* buf, int32_t nbytes) {
+    if((buf == NULL) || (nbytes < 0))
+        return -1;
+
+    if(stats_set_text((const int8_t*) buf, nbytes, 0) != 0)
+        return -1;
+
+    return nbytes;
+}
@@ -0,0 +1,41 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "types.h"
+#include "lib.h"
+#include "process.h"
+
+/* Virtual "stats" file exposing kernel counters as text */
+#define STATS_NAME          "stats"
+#define MAX_STATS           64
+#define STATS_NAME_LEN      24
+#define STATS_BUF_SIZE      2048
+
+/* Longest "name=value" pair stats_set_text accepts */
+#define STATS_PAIR_LEN      (STATS_NAME_LEN + 12)
+
+typedef struct stat_entry {
+    int8_t name[STATS_NAME_LEN];
+    volatile uint32_t* counter;
+    int32_t (*set)(uint32_t value);     /* NULL for read-only counters */
+} stat_entry_t;
+
+/* Adds a counter to the stats file */
+extern int32_t stats_register(const int8_t* name, volatile uint32_t* counter);
+/* Adds a tunable to the stats file, set validates and applies written values */
+extern int32_t stats_register_tunable(const int8_t* name, volatile uint32_t* counter,
+                                      int32_t (*set)(uint32_t value));
+/* Sets tunables from "name=value" pairs, returns how many were rejected */
+extern int32_t stats_set_text(const int8_t* text, int32_t len, int32_t ignore_unknown);
+/* Returns 1 if filename names the stats file */
+extern int32_t is_stats_file(const uint8_t* filename);
+
+/* Stats file driver functions */
+extern int32_t stats_open(const uint8_t* filename, int fd);
+extern int32_t stats_close(int32_t fd);
+extern int32_t stats_read(int32_t fd, void* buf, int32_t nbytes);
+extern int32_t stats_write(int32_t fd, const void* buf, int32_t nbytes);
+extern int32_t stats_lseek(int32_t fd, int32_t offset, int32_t whence);
+extern int32_t stats_pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+
+#endif
@@ -1,4 +1,5 @@
 #include "syscalls.h"
+#include "fpu.h"
 
 /*
  * syscall 1 - 10
@@ -9,32 +10,73 @@
  *   SIDE EFFECTS: halt loop
  */
 
-uint32_t pid_arr[MAX_RUNNING_PROCESSES];
 static char msg[BUFFER_SIZE];
 volatile int32_t isr_ret = 0;
 
 typedef int32_t func();
+
+/* Devices that have no file position */
+static int32_t no_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    return -1;
+}
+
+static int32_t no_pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset) {
+    return -1;
+}
+
+/*
+ * user_range_ok
+ *   DESCRIPTION: Checks that a buffer the kernel will write for a user program
+ *                lies wholly in user space
+ *   INPUTS: buf    - start of the buffer
+ *           nbytes - size of the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if [buf, buf + nbytes) is in user space, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int32_t user_range_ok(const void* buf, uint32_t nbytes) {
+    uint32_t start = (uint32_t) buf;
+
+    return (start >= USER_PAGE_START) && (start <= USER_STACK_TOP) &&
+           (nbytes <= USER_STACK_TOP - start);
+}
+
 /* directory file operations table */
-int32_t dir_fops[4] = {      (int32_t)(dir_open),
+int32_t dir_fops[NUM_FOPS] = { (int32_t)(dir_open),
                               (int32_t)(dir_close),
                               (int32_t)(dir_read),
-                              (int32_t)(dir_write)};
+                              (int32_t)(dir_write),
+                              (int32_t)(dir_lseek),
+                              (int32_t)(no_pread)};
 
 /* file file operations table*/
-int32_t file_fops[4] = {  (int32_t)(file_open),
+int32_t file_fops[NUM_FOPS] = { (int32_t)(file_open),
                            (int32_t)(file_close),
                            (int32_t)(file_read),
-                           (int32_t)(file_write)};
+                           (int32_t)(file_write),
+                           (int32_t)(file_lseek),
+                           (int32_t)(file_pread)};
 /*RTC operation table*/
-int32_t rtc_fops[4] = {  (int32_t)(RTC_open),
+int32_t rtc_fops[NUM_FOPS] = { (int32_t)(RTC_open),
                           (int32_t)(RTC_close),
                           (int32_t)(RTC_read),
-                          (int32_t)(RTC_write)};
+                          (int32_t)(RTC_write),
+                          (int32_t)(no_lseek),
+                          (int32_t)(no_pread)};
+/*stats file operation table*/
+int32_t stats_fops[NUM_FOPS] = { (int32_t)(stats_open),
+                            (int32_t)(stats_close),
+                            (int32_t)(stats_read),
+                            (int32_t)(stats_write),
+                            (int32_t)(stats_lseek),
+                            (int32_t)(stats_pread)};
 /*stdin & stdout operation table*/
-int32_t terminal_fops[4] = { (int32_t)(terminal_open),
+int32_t terminal_fops[NUM_FOPS] = { (int32_t)(terminal_open),
                            (int32_t)(terminal_close),
                            (int32_t)(terminal_read),
-                           (int32_t)(terminal_write)};
+                           (int32_t)(terminal_write),
+                           (int32_t)(no_lseek),
+                           (int32_t)(no_pread)};
 
 /*
  * do_halt
@@ -50,41 +92,89 @@ int32_t do_halt(uint8_t status){
     cli();
     pcb_t* cur = get_pcb();
     pcb_t* parent = NULL;
+    uint32_t pid = cur->pid;
+    uint32_t on_term = cur->on_term;
 
-    // Close any relevant FDs
+    // Close any relevant FDs, stdin and stdout are freed here
     int fd;
     for(fd = 0; fd < MAX_OPEN_FILES; fd++)
         close(fd);
+    kmem_cache_free(&file_cache, cur->fd_arr[0]);
+    kmem_cache_free(&file_cache, cur->fd_arr[1]);
+    cur->fd_arr[0] = NULL;
+    cur->fd_arr[1] = NULL;
+
+    // Account for the pages this program actually touched
+    image_pages += (cur->image_size + FOUR_KB - 1) / FOUR_KB;
+    image_pages_loaded += cur->pages_loaded;
+    image_cache_put(cur->image_slot);
+    fs_task_put(cur);
+
+    // Give the private pages, page tables and page directory back to the frame allocator
+    free_user_pages(cur);
+    fpu_release(cur);
+
+    // Forked children run on without us, the ones that already halted are freed
+    task_disown_children(cur);
+
+    /* A forked process stays a zombie (with its stack and pid) until its
+     * parent's wait frees it, and never runs again
+     */
+    if(cur->forked) {
+        task_zombie(cur, (isr_ret == EXCEP_RET) ? EXCEP_RET : status);
+        isr_ret = 0;
+        schedule();
+        while(1) {
+            sti();
+            asm volatile("hlt");
+        }
+    }
 
     // Free PID
-    pid_arr[cur->pid] = NOT_USED;
+    pid_free(pid);
 
     /* If current process is a child */
-    if(cur->pid > THIRD_SHELL) {
+    if(pid > THIRD_SHELL) {
         // Restore parent data
         parent = cur->parent;
+        parent->state = TASK_RUNNING;
 
         // Restore active pid
-        terminals[cur->on_term].active_pid = parent->pid;
+        terminals[on_term].active_pid = parent->pid;
 
         // Restore parent paging
         tss.ss0 = KERNEL_DS;
-        tss.esp0 = parent->kernel_stack;
+        tss.esp0 = parent->kstack + EIGHT_KB;
 
-        // Map 0x08000000 to 0x08400000 (128 to 132-MB) to (8MB + PARENT_PID * 4MB)
-        page_directory[32] = (uint32_t) (FIRST_USER+(parent->pid)*FOUR_MB) | 0x87;
-        flushTLB();
+        // Switch back to the parent's address space
+        map_user_process(parent);
+        fpu_switch(parent);
+
+        // Free the PCB and the kernel stack we are still running on; interrupts
+        // are off and nothing allocates before exec_return switches stacks
+        pcb_arr[pid] = NULL;
+        frame_free_run(cur->kstack, KSTACK_FRAMES);
+        kmem_cache_free(&pcb_cache, cur);
     } else {
-        do_execute((const uint8_t*) "shell");
+        // Root shells restart on the stack they are running on, do_execute
+        // only comes back if the restart failed (out of memory): say so and
+        // try again once other tasks had a chance to give memory back
+        while(1) {
+            do_execute((const uint8_t*) "shell");
+            strcpy((int8_t*) msg, (const int8_t*) "Cannot restart the shell, retrying\n");
+            terminal_write(1, (const void*) msg, strlen(msg));
+            sti();
+            asm volatile("hlt");
+            cli();
+        }
     }
 
-    terminals[cur->on_term].vid_map_flag = 0;
-
-    asm volatile("movl %0, %%ecx" : :"r"(cur->pid) :"ecx");
-    /* Expand 8-bit argument to the parent program's execute call */
-    asm volatile("movzb %0, %%eax" : :"r"(status) :"eax");
+    terminals[on_term].vid_map_flag = 0;
 
-    asm volatile("jmp exec_return");
+    /* PID in ECX, 8-bit argument expanded for the parent program's execute
+     * call in EAX, one statement so the compiler cannot reuse the registers
+     */
+    asm volatile("jmp exec_return" : :"c"(pid), "a"((uint32_t) status));
 
     return 0;
 }
@@ -99,69 +189,115 @@ int32_t do_halt(uint8_t status){
  *   RETURN VALUE: If       -1, the command cannot be executed
  *                    0 to 255, the program executes a halt syscall
  *                         256, the program dies by exception
- *   SIDE EFFECTS: If succesful, the new program is executed
+ *   SIDE EFFECTS: If succesful, the new program is executed. A root shell
+ *                 restarting from do_halt keeps its PCB and stack on failure
  */
 int32_t do_execute(const uint8_t* command){
     cli();
-    /* Parse arguments*/
+    /* Parse arguments into buffers from the kernel heap */
     const uint8_t* str = command;
-    uint8_t cmd[BUFFER_SIZE];
-    uint8_t args[BUFFER_SIZE];
+    uint8_t* cmd = kmalloc(BUFFER_SIZE);
+    uint8_t* args = kmalloc(BUFFER_SIZE);
+
+    if(!command || !cmd || !args) {
+        kfree(cmd);
+        kfree(args);
+        return -1;
+    }
     parse_args(str, cmd, args);
 
     /* Executable check */
-    if(!command || !isExe(cmd))
+    if(!isExe(cmd)) {
+        kfree(cmd);
+        kfree(args);
         return -1;
+    }
 
     // Get free pid
-    uint32_t pid = MAX_RUNNING_PROCESSES;
-    int i;
-    for(i = 0; i < MAX_RUNNING_PROCESSES; i++) {
-        if(pid_arr[i] == NOT_USED) {
-            pid = i;
-            pid_arr[i] = USED;
-            break;
-        }
-    }
+    int32_t pid = pid_alloc();
 
-    if(pid >= MAX_RUNNING_PROCESSES) {
+    if(pid == NO_PID) {
+        kfree(cmd);
+        kfree(args);
         strcpy((int8_t*) msg, (const int8_t*) "Too many processes!\n");
         terminal_write(1, (const void*) msg, strlen(msg));
         return 0;
     }
 
-    /* Set-up program paging */
+    /* The PCB comes from the PCB cache, the kernel stack and page directory
+     * from the frame allocator. A restarting root shell keeps the PCB and
+     * stack it is running on
+     */
+    pcb_t* task_pcb = pcb_arr[pid];
+    int32_t new_task = (task_pcb == NULL);
+    uint32_t kstack;
+    if(new_task) {
+        task_pcb = kmem_cache_alloc(&pcb_cache);
+        kstack = frame_alloc_run(KSTACK_FRAMES);
+    } else {
+        kstack = task_pcb->kstack;
+    }
 
-    // Set up 1 4-MB page for task
-    // Map 0x08000000 to 0x08400000 (128 to 132-MB) to (8MB + PID * 4MB)
-    // Attributes: page size, user level, read/write, present
-    page_directory[32] = (uint32_t) (FIRST_USER + pid * FOUR_MB)  | 0x87;
+    /* Create PCB */
+    if(task_pcb != NULL)
+        memset((void*) task_pcb, 0, sizeof(pcb_t));
 
-    // Flush TLB after page swap
-    flushTLB();
+    if((task_pcb == NULL) || (kstack == NO_FRAME) || (init_pcb(pid, task_pcb) == -1) ||
+       (create_page_directory(task_pcb) == -1)) {
+        if(task_pcb != NULL) {
+            kmem_cache_free(&file_cache, task_pcb->fd_arr[0]);
+            kmem_cache_free(&file_cache, task_pcb->fd_arr[1]);
+        }
+        if(new_task) {
+            kmem_cache_free(&pcb_cache, task_pcb);
+            if(kstack != NO_FRAME)
+                frame_free_run(kstack, KSTACK_FRAMES);
+            pcb_arr[pid] = NULL;
+        } else {
+            /* A restarting root shell still runs on this PCB and stack, they
+             * stay its own for do_halt to retry with
+             */
+            task_pcb->pid = pid;
+            task_pcb->on_term = pid;
+            task_pcb->kstack = kstack;
+            task_pcb->state = TASK_RUNNING;
+        }
+        pid_free(pid);
+        kfree(cmd);
+        kfree(args);
+        return -1;
+    }
+
+    task_pcb->kstack = kstack;
+    pcb_arr[pid] = task_pcb;
 
-    /* Load program */
-    uint32_t entry = program_load((const uint8_t*) cmd);
+    // get_pcb finds the PCB through the bottom of the kernel stack
+    *(pcb_t**) kstack = task_pcb;
+    uint32_t km_stack = kstack + EIGHT_KB;
 
-    /* Create PCB (do not allocate) */
-    uint32_t km_stack = (EIGHT_MB) - (pid * EIGHT_KB);
-    pcb_t* task_pcb = (pcb_t*) (km_stack - EIGHT_KB);
-    pcb_t tmp_pcb;
-    init_pcb(pid,&tmp_pcb);
+    /* Set-up program paging */
 
-    memcpy((void*) task_pcb, (void*) &tmp_pcb, sizeof(pcb_t));
+    // Switch to the task's (empty) page directory, user pages and their
+    // page tables are backed by frames allocated on demand
+    map_user_process(task_pcb);
     strncpy((int8_t*) task_pcb->buffCopyArg, (const int8_t*) args, strlen((const int8_t*)args));
 
+    /* Load program (pages are faulted in on first touch) */
+    uint32_t entry = program_load((const uint8_t*) cmd, task_pcb);
+    kfree(cmd);
+    kfree(args);
+
     /* Context switch */
 
     // Record which terminal the process is executing in
 
-    // If this is a child process
+    // If this is a child process, it runs on its parent's terminal while the parent waits
     if(pid > THIRD_SHELL) {
         pcb_t* parent = (pcb_t*) get_pcb();
         task_pcb->parent = parent;
-        terminals[curr_terminal].active_pid = pid;
-        task_pcb->on_term = curr_terminal;
+        parent->state = TASK_IN_EXECUTE;
+        terminals[parent->on_term].active_pid = pid;
+        task_pcb->on_term = parent->on_term;
     }
     else {
         terminals[pid].active_pid = pid;
@@ -172,13 +308,13 @@ int32_t do_execute(const uint8_t* command){
     tss.ss0 = KERNEL_DS;
     tss.esp0 = km_stack;
     task_pcb->kernel_stack = km_stack;
+    fpu_switch(task_pcb);
 
     int32_t ret = 0;
     isr_ret = 0;
-    context_setup(entry,USER_STACK,pid);
 
     // Return 0 to 255 (from halt) on program halt
-    asm volatile("movl %%eax, %0" :"=r" (ret));
+    ret = context_setup(entry,USER_STACK,pid);
 
     if(isr_ret == EXCEP_RET)
         return isr_ret;
@@ -194,24 +330,29 @@ int32_t do_execute(const uint8_t* command){
  *   INPUTS: pid - Process ID (PID) number of process
  *           pcb - pointer to PCB of current process
  *   OUTPUTS: none
- *   RETURN VALUE: 0 on success
+ *   RETURN VALUE: 0 on success, -1 if the stdin/stdout file objects could not be allocated
  *   SIDE EFFECTS: If succesful, the PCB of the current process is modified
  */
 int32_t init_pcb(uint32_t pid, pcb_t* pcb) {
     pcb->pid = pid;
 
     int i;
+    pcb->mmap_next = 0;
+    pcb->brk = USER_HEAP_START;
+
     /* Set all files to unused */
-    for(i = 0; i < MAX_OPEN_FILES; i++) {
-        pcb->fd_arr[i].flags = NOT_USED;
-        pcb->fd_arr[i].fpos = 0;
-    }
+    for(i = 0; i < MAX_OPEN_FILES; i++)
+        pcb->fd_arr[i] = NULL;
 
     /* Set stdin and stdout */
-    pcb->fd_arr[0].flags = USED;
-    pcb->fd_arr[0].fops = (int32_t*)terminal_fops;
-    pcb->fd_arr[1].flags = USED;
-    pcb->fd_arr[1].fops = (int32_t*)terminal_fops;
+    for(i = 0; i < 2; i++) {
+        if((pcb->fd_arr[i] = kmem_cache_alloc(&file_cache)) == NULL)
+            return -1;
+        pcb->fd_arr[i]->flags = USED;
+        pcb->fd_arr[i]->fops = (int32_t*)terminal_fops;
+        pcb->fd_arr[i]->inode_num = 0;
+        pcb->fd_arr[i]->fpos = 0;
+    }
 
     return 0;
 }
@@ -263,11 +404,11 @@ int32_t parse_args(const uint8_t* str, uint8_t* cmd, uint8_t* args) {
 int32_t do_read (int32_t fd, void* buf, int32_t nbytes){
     sti();
     pcb_t* pcb_ptr = get_pcb();
-    if (fd < 0 || fd > MAX_OPEN_FILES || buf == NULL || nbytes == NULL || pcb_ptr->fd_arr[fd].flags == NOT_USED)
+    if (fd < 0 || fd >= MAX_OPEN_FILES || buf == NULL || nbytes == NULL || pcb_ptr->fd_arr[fd] == NULL)
     {
         return -1;
     }
-    int32_t (*read_jump)(int32_t, const void*, int32_t) = (void*) pcb_ptr->fd_arr[fd].fops[READ];
+    int32_t (*read_jump)(int32_t, const void*, int32_t) = (void*) pcb_ptr->fd_arr[fd]->fops[READ];
 
     /* De-referencing function pointer to dispatch to fd's read operation */
     return read_jump(fd, buf, nbytes);
@@ -286,11 +427,11 @@ int32_t do_read (int32_t fd, void* buf, int32_t nbytes){
 int32_t do_write (int32_t fd, const void* buf, int32_t nbytes){
     sti();
     pcb_t* pcb_ptr = get_pcb();
-    if (fd < 0 || fd > MAX_OPEN_FILES || buf == NULL || nbytes == NULL || pcb_ptr->fd_arr[fd].flags == NOT_USED)
+    if (fd < 0 || fd >= MAX_OPEN_FILES || buf == NULL || nbytes == NULL || pcb_ptr->fd_arr[fd] == NULL)
     {
         return -1;
     }
-    int32_t (*write_jump)(int32_t, const void*, int32_t) = (void*) pcb_ptr->fd_arr[fd].fops[WRITE];
+    int32_t (*write_jump)(int32_t, const void*, int32_t) = (void*) pcb_ptr->fd_arr[fd]->fops[WRITE];
 
     /* De-referencing function pointer to dispatch to fd's write operation */
     return write_jump(fd, buf, nbytes);
@@ -327,7 +468,7 @@ int32_t do_open (const uint8_t* filename) {
     for(x =2; x <8; x++)
     {
         //If the file is not in use
-        if(pcb_ptr->fd_arr[x].flags == NOT_USED)
+        if(pcb_ptr->fd_arr[x] == NULL)
         {
             fd = x;
             break;
@@ -337,27 +478,47 @@ int32_t do_open (const uint8_t* filename) {
     if (fd == 0)
         return -1;
 
+    // File objects come from the file cache
+    pcb_ptr->fd_arr[fd] = kmem_cache_alloc(&file_cache);
+    if(pcb_ptr->fd_arr[fd] == NULL)
+        return -1;
+    pcb_ptr->fd_arr[fd]->inode_num = 0;
+    pcb_ptr->fd_arr[fd]->fpos = 0;
+
     // Let's check if it's a directory
     if(open_dentry.filetype == DIR_FILE)
     {
-        pcb_ptr->fd_arr[fd].fops = (int32_t*)dir_fops;
-        pcb_ptr->fd_arr[fd].flags = USED;
+        pcb_ptr->fd_arr[fd]->fops = (int32_t*)dir_fops;
+        pcb_ptr->fd_arr[fd]->flags = USED;
         ((func *)(dir_fops[OPEN]))(filename, fd);
     }
     // Let's check if it's a regular file
     else if(open_dentry.filetype == REG_FILE)
     {
-        pcb_ptr->fd_arr[fd].fops = (int32_t*) file_fops;
-        pcb_ptr->fd_arr[fd].flags = USED;
+        pcb_ptr->fd_arr[fd]->fops = (int32_t*) file_fops;
+        pcb_ptr->fd_arr[fd]->flags = USED;
         ((func *)(file_fops[OPEN]))(filename, fd);
     }
     // Let's check if it's a rtc file
     else if (open_dentry.filetype == RTC_FILE)
     {
-        pcb_ptr -> fd_arr[fd].fops = (int32_t*) rtc_fops;
-        pcb_ptr->fd_arr[fd].flags = USED;
+        pcb_ptr -> fd_arr[fd]->fops = (int32_t*) rtc_fops;
+        pcb_ptr->fd_arr[fd]->flags = USED;
         ((func *)(rtc_fops[OPEN]))(fd);
     }
+    // Let's check if it's the kernel stats file
+    else if (open_dentry.filetype == STATS_FILE)
+    {
+        pcb_ptr->fd_arr[fd]->fops = (int32_t*) stats_fops;
+        pcb_ptr->fd_arr[fd]->flags = USED;
+        ((func *)(stats_fops[OPEN]))(filename, fd);
+    }
+    else
+    {
+        kmem_cache_free(&file_cache, pcb_ptr->fd_arr[fd]);
+        pcb_ptr->fd_arr[fd] = NULL;
+        return -1;
+    }
 
     return fd;
 }
@@ -369,28 +530,28 @@ int32_t do_open (const uint8_t* filename) {
  *   OUTPUTS: none
  *   RETURN VALUE: If       -1, for input 0 and 1 or invalid descriptor.
  *                           0 value, when the file is close
- *   SIDE EFFECTS: If succesful, the file flag should be set to NOT_USED.
+ *   SIDE EFFECTS: If succesful, the file object is freed and the fd is unused.
  */
 int32_t do_close (int32_t fd){
     cli();
-    if( fd < 2 || fd> MAX_OPEN_FILES)
+    if( fd < 2 || fd >= MAX_OPEN_FILES)
     {
         return -1;
     }
     // First, extract the PCB again
     pcb_t* pcb_ptr = get_pcb();
     /* If the file is already closed */
-    if(pcb_ptr -> fd_arr[fd].flags == NOT_USED)
+    if(pcb_ptr -> fd_arr[fd] == NULL)
     {
         return -1;
     }
-    /* Now we are facing an open file */
-    pcb_ptr->fd_arr[fd].flags = NOT_USED;
-    pcb_ptr->fd_arr[fd].fpos = 0;
-    pcb_ptr->fd_arr[fd].inode_num = 0;
-    int32_t (*close_jump)(int32_t) = (void*) pcb_ptr->fd_arr[fd].fops[CLOSE];
+    /* Now we are facing an open file, close it and give its object back to the file cache */
+    int32_t (*close_jump)(int32_t) = (void*) pcb_ptr->fd_arr[fd]->fops[CLOSE];
+    int32_t ret = close_jump(fd);
+    kmem_cache_free(&file_cache, pcb_ptr->fd_arr[fd]);
+    pcb_ptr->fd_arr[fd] = NULL;
 
-    return close_jump(fd);
+    return ret;
 }
 
 /*
@@ -434,25 +595,433 @@ int32_t do_vidmap (uint8_t** screen_start){
     cli();
     pcb_t* cur_task = get_pcb();
 
-    /* Check if screen_start within user page */
-    if(((uint32_t) screen_start < USER_PAGE_START) || ((uint32_t) screen_start > USER_PAGE_END))
+    /* Check if screen_start within user space */
+    if(((uint32_t) screen_start < USER_PAGE_START) ||
+       ((uint32_t) screen_start > USER_STACK_TOP - sizeof(uint8_t*)))
         return -1;
 
     /* Map 4-kB page at 2-GB to video-memory */
     uint32_t vaddr = TWO_GB;
+    uint32_t* pte = user_pte(cur_task, vaddr, 1);
+    if(pte == NULL)
+        return -1;
 
-    /* Map 4-kB page (at 2-GB) to Video Memory
+    /* Map 4-kB page (at 2-GB) to Video Memory, or to the backing page of the
+     * task's terminal while another one is displayed. The page is not owned,
+     * so it is not freed with the process
      * attributes: user level, read/write, present
      */
     terminals[cur_task->on_term].vid_map_flag = 1;
-    user_vidmem_page_table[0] = (uint32_t) VIDEO_MEMORY | 0x7;
-    flushTLB();
+    if(cur_task->on_term == curr_terminal)
+        *pte = (uint32_t) VIDEO_MEMORY | 0x7;
+    else
+        *pte = (uint32_t) (VIDEO_MEMORY + (cur_task->on_term+1) * (FOUR_KB)) | 0x7;
+    flushTLBEntry(vaddr);
 
     *screen_start = (uint8_t*) vaddr;
 
     return 0;
 }
 
+/*
+ * do_mmap
+ *   DESCRIPTION: Maps the data blocks of an open regular file read-only into
+ *                the process' mmap region, so the file can be read without a copy
+ *   INPUTS: fd    - file descriptor of an open regular file
+ *           start - pointer to a variable that receives the mapping's virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: Length of the file in bytes on success, -1 on failure or if
+ *                 MAX_MMAP_FILES other files are mapped already
+ *   SIDE EFFECTS: If succesful, fills entries of the process' mmap page tables
+ *                 and writes the virtual address of the mapping to start. The
+ *                 file cannot shrink or be freed until the process halts
+ */
+int32_t do_mmap (int32_t fd, uint8_t** start){
+    cli();
+    pcb_t* pcb_ptr = get_pcb();
+    uint32_t* pte;
+    uint32_t num_pages, length, i, vaddr, inode, m;
+    uint8_t* block;
+
+    if(fd < 2 || fd >= MAX_OPEN_FILES || pcb_ptr->fd_arr[fd] == NULL)
+        return -1;
+
+    /* Only regular files are backed by data blocks */
+    if(pcb_ptr->fd_arr[fd]->fops != (int32_t*) file_fops)
+        return -1;
+
+    /* Check if start within user space */
+    if(((uint32_t) start < USER_PAGE_START) || ((uint32_t) start > USER_STACK_TOP - sizeof(uint8_t*)))
+        return -1;
+
+    /* Compressed files have no raw blocks to map */
+    if(fmeta[pcb_ptr->fd_arr[fd]->inode_num].flags & INODE_COMPRESSED)
+        return -1;
+
+    length = fmeta[pcb_ptr->fd_arr[fd]->inode_num].size;
+    num_pages = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if(pcb_ptr->mmap_next + num_pages > (USER_MMAP_END - USER_MMAP_START) / FOUR_KB)
+        return -1;
+
+    /* The file stays pinned (its blocks are not freed) until we halt */
+    inode = pcb_ptr->fd_arr[fd]->inode_num;
+    for(m = 0; (m < pcb_ptr->mmap_files) && (pcb_ptr->mmap_inodes[m] != inode); m++);
+    if(m == MAX_MMAP_FILES)
+        return -1;
+
+    /* Data blocks are page aligned in the boot image, so each block is
+     * mapped as one 4-kB page. Runs of contiguous blocks end up as runs of
+     * contiguous frames, scattered blocks are stitched together page by page.
+     * Attributes: user level, read-only, present
+     */
+    for(i = 0; i < num_pages; i++) {
+        block = fs_block(pcb_ptr->fd_arr[fd]->inode_num, i);
+        pte = user_pte(pcb_ptr, USER_MMAP_START + (pcb_ptr->mmap_next + i) * FOUR_KB, 1);
+        if((block == NULL) || (pte == NULL))
+            break;
+        *pte = (uint32_t) block | 0x5;
+    }
+
+    /* Take back the pages already mapped, the next mmap reuses their addresses */
+    if(i < num_pages) {
+        while(i-- > 0) {
+            vaddr = USER_MMAP_START + (pcb_ptr->mmap_next + i) * FOUR_KB;
+            *user_pte(pcb_ptr, vaddr, 0) = 0;
+            flushTLBEntry(vaddr);
+        }
+        return -1;
+    }
+    /* The entries past mmap_next were not present, nothing to flush */
+
+    if(m == pcb_ptr->mmap_files) {
+        pcb_ptr->mmap_inodes[pcb_ptr->mmap_files++] = inode;
+        fs_inode_get(inode, 1);
+    }
+
+    *start = (uint8_t*) (USER_MMAP_START + pcb_ptr->mmap_next * FOUR_KB);
+    pcb_ptr->mmap_next += num_pages;
+
+    return length;
+}
+
+/*
+ * do_create
+ *   DESCRIPTION: Creates an empty regular file, or truncates an existing one
+ *   INPUTS: filename - name of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: If succesful, the file exists with length 0
+ */
+int32_t do_create (const uint8_t* filename){
+    cli();
+    return fs_create(filename);
+}
+
+/*
+ * do_unlink
+ *   DESCRIPTION: Removes a regular file from the file system
+ *   INPUTS: filename - name of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: If succesful, the file's blocks and inode are freed
+ */
+int32_t do_unlink (const uint8_t* filename){
+    cli();
+    return fs_unlink(filename);
+}
+
+/*
+ * do_getdents
+ *   DESCRIPTION: Reads as many directory records (name, type, inode, length) as
+ *                fit in buf from an open directory
+ *   INPUTS: fd     - file descriptor of an open directory
+ *           buf    - buffer for dirent_t records
+ *           nbytes - size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: Number of bytes filled, 0 at the end of the directory, -1 on
+ *                 failure or if buf is not in user space
+ *   SIDE EFFECTS: If succesful, advances the directory position
+ */
+int32_t do_getdents (int32_t fd, void* buf, int32_t nbytes){
+    cli();
+    pcb_t* pcb_ptr = get_pcb();
+
+    if(fd < 2 || fd >= MAX_OPEN_FILES || pcb_ptr->fd_arr[fd] == NULL)
+        return -1;
+
+    /* Only directories have records */
+    if(pcb_ptr->fd_arr[fd]->fops != (int32_t*) dir_fops)
+        return -1;
+
+    if((nbytes < 0) || !user_range_ok(buf, nbytes))
+        return -1;
+
+    return dir_getdents(fd, buf, nbytes);
+}
+
+/*
+ * do_stat
+ *   DESCRIPTION: Looks up a file's type, inode, size and block count by name
+ *   INPUTS: filename - name of the file
+ *           buf      - receives the file's metadata
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure or if buf is not in user space
+ *   SIDE EFFECTS: If succesful, fills in buf
+ */
+int32_t do_stat (const uint8_t* filename, stat_t* buf){
+    cli();
+    dentry_t stat_dentry;
+
+    if(!user_range_ok(buf, sizeof(stat_t)))
+        return -1;
+
+    if((filename == NULL) || (read_dentry_by_name(filename, &stat_dentry) == -1))
+        return -1;
+
+    return fs_stat(&stat_dentry, buf);
+}
+
+/*
+ * do_fstat
+ *   DESCRIPTION: Looks up type, inode, size and block count of an open file
+ *   INPUTS: fd  - file descriptor
+ *           buf - receives the file's metadata
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure or if buf is not in user space
+ *   SIDE EFFECTS: If succesful, fills in buf
+ */
+int32_t do_fstat (int32_t fd, stat_t* buf){
+    cli();
+    pcb_t* pcb_ptr = get_pcb();
+    dentry_t stat_dentry;
+    int32_t* fops;
+
+    if(fd < 2 || fd >= MAX_OPEN_FILES || pcb_ptr->fd_arr[fd] == NULL)
+        return -1;
+
+    if(!user_range_ok(buf, sizeof(stat_t)))
+        return -1;
+
+    /* The fops table tells what kind of file is open */
+    fops = pcb_ptr->fd_arr[fd]->fops;
+    if(fops == (int32_t*) file_fops)
+        stat_dentry.filetype = REG_FILE;
+    else if(fops == (int32_t*) dir_fops)
+        stat_dentry.filetype = DIR_FILE;
+    else if(fops == (int32_t*) rtc_fops)
+        stat_dentry.filetype = RTC_FILE;
+    else
+        stat_dentry.filetype = STATS_FILE;
+    stat_dentry.inode_num = pcb_ptr->fd_arr[fd]->inode_num;
+
+    return fs_stat(&stat_dentry, buf);
+}
+
+/*
+ *   do_lseek
+ *   DESCRIPTION: Lseek system call handler, dispatches to the fd's lseek operation
+ *   INPUTS: fd     - file descriptor
+ *           offset - signed offset from the point picked by whence
+ *           whence - SEEK_SET, SEEK_CUR or SEEK_END
+ *   OUTPUTS: none
+ *   RETURN VALUE: new file position, -1 on failure or if the file is not seekable
+ *   SIDE EFFECTS: jumps to corresponding lseek function based on fd
+ */
+int32_t do_lseek (int32_t fd, int32_t offset, int32_t whence){
+    cli();
+    pcb_t* pcb_ptr = get_pcb();
+    if (fd < 0 || fd >= MAX_OPEN_FILES || pcb_ptr->fd_arr[fd] == NULL)
+        return -1;
+
+    int32_t (*lseek_jump)(int32_t, int32_t, int32_t) = (void*) pcb_ptr->fd_arr[fd]->fops[LSEEK];
+    return lseek_jump(fd, offset, whence);
+}
+
+/*
+ *   do_pread
+ *   DESCRIPTION: Pread system call handler, dispatches to the fd's pread operation
+ *   INPUTS: fd     - file descriptor
+ *           buf    - buffer to fill
+ *           nbytes - number of bytes to read
+ *           offset - where to start reading
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read, -1 on failure, if buf is not in user
+ *                 space or if the file is not seekable
+ *   SIDE EFFECTS: jumps to corresponding pread function based on fd, the file
+ *                 position does not move. Runs with interrupts on like do_read,
+ *                 the pread operations lock what they share
+ */
+int32_t do_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset){
+    sti();
+    pcb_t* pcb_ptr = get_pcb();
+    if (fd < 0 || fd >= MAX_OPEN_FILES || pcb_ptr->fd_arr[fd] == NULL)
+        return -1;
+
+    /* The fops write straight into buf */
+    if((nbytes < 0) || !user_range_ok(buf, nbytes))
+        return -1;
+
+    int32_t (*pread_jump)(int32_t, void*, int32_t, int32_t) = (void*) pcb_ptr->fd_arr[fd]->fops[PREAD];
+    return pread_jump(fd, buf, nbytes, offset);
+}
+
+/*
+ *   do_brk
+ *   DESCRIPTION: Brk system call handler, moves the end of the process' heap.
+ *                Heap pages are backed on first touch by the page fault handler,
+ *                so growing only moves the break
+ *   INPUTS: addr - new end of the heap
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if addr is outside the heap region
+ *   SIDE EFFECTS: Sets the break; when shrinking, pages wholly above the new
+ *                 break are unmapped and their frames freed
+ */
+int32_t do_brk (void* addr){
+    cli();
+    pcb_t* pcb_ptr = get_pcb();
+    uint32_t new_brk = (uint32_t) addr;
+
+    if((new_brk < USER_HEAP_START) || (new_brk > USER_HEAP_END))
+        return -1;
+
+    if(new_brk < pcb_ptr->brk)
+        unmap_user_pages(pcb_ptr, (new_brk + FOUR_KB - 1) & ~(FOUR_KB - 1),
+                         (pcb_ptr->brk + FOUR_KB - 1) & ~(FOUR_KB - 1));
+    pcb_ptr->brk = new_brk;
+    return 0;
+}
+
+/*
+ *   do_sbrk
+ *   DESCRIPTION: Sbrk system call handler, grows (or shrinks) the process'
+ *                heap by increment bytes
+ *   INPUTS: increment - bytes to add to the heap, negative to give memory back
+ *   OUTPUTS: none
+ *   RETURN VALUE: the old break (start of the new memory) on success, -1 if
+ *                 the heap would leave the heap region
+ *   SIDE EFFECTS: see do_brk
+ */
+int32_t do_sbrk (int32_t increment){
+    cli();
+    uint32_t old_brk = get_pcb()->brk;
+
+    if(do_brk((void*) (old_brk + increment)) == -1)
+        return -1;
+    return old_brk;
+}
+
+/*
+ *   do_fork
+ *   DESCRIPTION: Fork system call handler, creates a copy of the calling process
+ *                that runs alongside it. The address space is shared copy on
+ *                write, open files are duplicated (each side has its own position)
+ *                and so is the FPU state
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pid of the child in the parent, 0 in the child, -1 on failure
+ *   SIDE EFFECTS: The child is runnable right away, it starts by returning from
+ *                 this system call through fork_return
+ */
+int32_t do_fork (void){
+    cli();
+    pcb_t* parent = get_pcb();
+    pcb_t* child;
+    uint32_t frame, fd;
+    int32_t pid = pid_alloc();
+
+    if(pid == NO_PID)
+        return -1;
+    if((child = kmem_cache_alloc(&pcb_cache)) == NULL) {
+        pid_free(pid);
+        return -1;
+    }
+
+    /* Terminal, image, heap, mmap and argument state are inherited */
+    memcpy((void*) child, (void*) parent, sizeof(pcb_t));
+    child->pid = pid;
+    child->parent = parent;
+    child->forked = 1;
+    child->page_dir = NULL;
+    child->fpu_state = NULL;
+    for(fd = 0; fd < MAX_OPEN_FILES; fd++)
+        child->fd_arr[fd] = NULL;
+    child->kstack = frame_alloc_run(KSTACK_FRAMES);
+
+    for(fd = 0; (fd < MAX_OPEN_FILES) && (child->kstack != NO_FRAME); fd++) {
+        if(parent->fd_arr[fd] == NULL)
+            continue;
+        if((child->fd_arr[fd] = kmem_cache_alloc(&file_cache)) == NULL)
+            break;
+        memcpy((void*) child->fd_arr[fd], (void*) parent->fd_arr[fd], sizeof(file_t));
+        if(child->fd_arr[fd]->fops == (int32_t*) file_fops)
+            fs_inode_get(child->fd_arr[fd]->inode_num, 0);
+    }
+
+    if((child->kstack == NO_FRAME) || (fd < MAX_OPEN_FILES) ||
+       (copy_user_pages(parent, child) == -1) || (fpu_fork(parent, child) == -1)) {
+        task_free(child);
+        return -1;
+    }
+    image_cache_dup(child->image_slot);
+    fs_task_get(child);
+
+    /* Child kernel stack: a copy of the parent's system call frame, the
+     * first switch to the child returns into fork_return below it, which
+     * returns 0 to user level
+     */
+    *(pcb_t**) child->kstack = child;
+    frame = child->kstack + EIGHT_KB - SYSCALL_FRAME_SIZE;
+    memcpy((void*) frame, (void*) (parent->kstack + EIGHT_KB - SYSCALL_FRAME_SIZE), SYSCALL_FRAME_SIZE);
+    task_stack_init(child, frame, fork_return);
+
+    pcb_arr[pid] = child;
+    sched_add(child);
+    return pid;
+}
+
+/*
+ *   do_wait
+ *   DESCRIPTION: Wait system call handler, collects a forked child that halted,
+ *                blocking until one does
+ *   INPUTS: status - where to store the child's halt status (EXCEP_RET if an
+ *                    exception killed it), may be NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: pid of the collected child, -1 if there are no forked children
+ *   SIDE EFFECTS: Frees the child. The caller sleeps in TASK_IN_WAIT meanwhile
+ */
+int32_t do_wait (int32_t* status){
+    cli();
+    pcb_t* cur = get_pcb();
+    pcb_t* child;
+    uint32_t pid, children;
+
+    if((status != NULL) && (((uint32_t) status < USER_PAGE_START) ||
+       ((uint32_t) status > USER_STACK_TOP - sizeof(int32_t))))
+        return -1;
+
+    while(1) {
+        children = 0;
+        for(pid = 0; pid < MAX_PIDS; pid++) {
+            child = pcb_arr[pid];
+            if((child == NULL) || (child->parent != cur) || !child->forked)
+                continue;
+            children++;
+            if(child->state == TASK_ZOMBIE) {
+                if(status != NULL)
+                    *status = child->exit_status;
+                task_free(child);
+                return pid;
+            }
+        }
+        if(children == 0)
+            return -1;
+
+        /* task_zombie makes us runnable again */
+        cur->state = TASK_IN_WAIT;
+        sched_block();
+    }
+}
+
 /* Function doesn't do anything meaningful */
 int32_t do_set_handler (int32_t signum, void* handler){
     strcpy((int8_t*) msg, (const int8_t*) "SET_HANDLER!\n");
@@ -9,15 +9,30 @@
 #include "terminal.h"
 #include "rtc.h"
 #include "schedule.h"
+#include "stats.h"
+#include "imgcache.h"
+#include "frame.h"
+#include "kmalloc.h"
 
 /* Indices for fops table (jumptable) */
 #define OPEN                  0
 #define CLOSE                 1
 #define READ                  2
 #define WRITE                 3
+#define LSEEK                 4
+#define PREAD                 5
+#define NUM_FOPS              6
 
 #define EXCEP_RET           256
-#define MAX_RUNNING_PROCESSES 6
+
+/* System call frame on top of a kernel stack: iret frame (5 words), eflags,
+ * pushal (8 words) and the 4 argument registers pushed by syscall_wrapper
+ */
+#define SYSCALL_FRAME_SIZE  (18 * 4)
+
+/* Operations of regular files and of the directory */
+extern int32_t file_fops[NUM_FOPS];
+extern int32_t dir_fops[NUM_FOPS];
 
 // Syscall Wrapper functions
 extern int32_t halt(uint8_t status);
@@ -30,6 +45,19 @@ extern int32_t getargs(uint8_t* buf, int32_t nbytes);
 extern int32_t vidmap(uint8_t** screen_start);
 extern int32_t set_handler(int32_t signum, void* handler);
 extern int32_t sigreturn(void);
+extern int32_t mmap(int32_t fd, uint8_t** start);
+extern int32_t create(const uint8_t* filename);
+extern int32_t unlink(const uint8_t* filename);
+extern int32_t getdents(int32_t fd, void* buf, int32_t nbytes);
+struct stat;
+extern int32_t stat(const uint8_t* filename, struct stat* buf);
+extern int32_t fstat(int32_t fd, struct stat* buf);
+extern int32_t lseek(int32_t fd, int32_t offset, int32_t whence);
+extern int32_t pread(int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+extern int32_t sbrk(int32_t increment);
+extern int32_t brk(void* addr);
+extern int32_t fork(void);
+extern int32_t wait(int32_t* status);
 
 // Syscall Implementations
 extern int32_t do_halt (uint8_t status);
@@ -42,6 +70,18 @@ extern int32_t do_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t do_vidmap (uint8_t** screen_start);
 extern int32_t do_set_handler (int32_t signum, void* handler);
 extern int32_t do_sigreturn (void);
+extern int32_t do_mmap (int32_t fd, uint8_t** start);
+extern int32_t do_create (const uint8_t* filename);
+extern int32_t do_unlink (const uint8_t* filename);
+extern int32_t do_getdents (int32_t fd, void* buf, int32_t nbytes);
+extern int32_t do_stat (const uint8_t* filename, struct stat* buf);
+extern int32_t do_fstat (int32_t fd, struct stat* buf);
+extern int32_t do_lseek (int32_t fd, int32_t offset, int32_t whence);
+extern int32_t do_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+extern int32_t do_sbrk (int32_t increment);
+extern int32_t do_brk (void* addr);
+extern int32_t do_fork (void);
+extern int32_t do_wait (int32_t* status);
 
 /* Helper functions*/
 
@@ -49,11 +89,12 @@ extern int32_t do_sigreturn (void);
 extern int32_t init_pcb(uint32_t pid, pcb_t* pcb);
 /* Returns the address of the current process' PCB */
 extern pcb_t* get_pcb();
-/* Sets up the stack for context switching (IRET) */
-extern void context_setup(uint32_t entry_point, uint32_t user_stack, uint32_t pid);
+/* First code a forked child runs: returns 0 from fork to user level */
+extern void fork_return(void);
+/* Enters a program at user level (IRET), returns its halt value */
+extern int32_t context_setup(uint32_t entry_point, uint32_t user_stack, uint32_t pid);
 /* Parses the sequence of words passed into execute as command and arguments */
 extern int32_t parse_args(const uint8_t* str, uint8_t* cmd, uint8_t* args);
 
-extern uint32_t pid_arr[MAX_RUNNING_PROCESSES];
 
 #endif
@@ -7,14 +7,34 @@ static char terminal_buffer[BUFFER_SIZE];
 
 extern int ENTER_FLAG;
 extern int ENTER_FLAG_2, ENTER_FLAG_3;
-extern uint8_t cur_pid;
+extern uint32_t cur_pid;
 
 int TERMINAL_READ;		//Read flag
 
+/*
+ * enter_flag
+ *   DESCRIPTION: Finds the flag terminal_newline sets when enter is pressed on a terminal
+ *   INPUTS: term - terminal number
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to ENTER_FLAG, ENTER_FLAG_2 or ENTER_FLAG_3
+ *   SIDE EFFECTS: none
+ */
+static volatile int* enter_flag(uint32_t term) {
+	switch(term){
+		case 1:
+			return &ENTER_FLAG_2;
+		case 2:
+			return &ENTER_FLAG_3;
+		default:
+			return &ENTER_FLAG;
+	}
+}
+
 /*
  * Terminal read
  *   DESCRIPTION: Read function for terimanal. When entered it will not exit until user presses
- * 				  enter on the keyboard. Writes terminal buffer to input buffer
+ * 				  enter on the reader's terminal, sleeping on the terminal's read queue
+ * 				  meanwhile. Writes terminal buffer to input buffer
  *   INPUTS: fd, buf, nbytes
  *   OUTPUTS:
  *   RETURN VALUE: Amount of bytes read
@@ -22,7 +42,11 @@ int TERMINAL_READ;		//Read flag
  */
 int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) {
 	int i;
-	cur_task = get_pcb();
+	uint32_t flags;
+	/* cur_task is shared with every other task, keep our own */
+	pcb_t* task = get_pcb();
+	terminal_t* term = &terminals[task->on_term];
+	volatile int* entered = enter_flag(task->on_term);
 
 	/* Checking for valid inputs */
 	if (fd != 0 || fd > MAX_OPEN_FILES || buf == NULL || nbytes < 0) {
@@ -32,41 +56,31 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) {
 		return 0;
 	}
 
+	/* Begin critical section, clear interrupts */
+	cli_and_save(flags);
 	TERMINAL_READ = 1;
 
-	/* Waiting for user to press enter */
-	LOOP:sti();
-	while(!ENTER_FLAG && !ENTER_FLAG_2 && !ENTER_FLAG_3){}
-
-	/* Begin critical section, clear interrupts*/
-	while (cur_task->on_term != curr_terminal){
-		cur_task = get_pcb();
-	}
-
-	cli();
-	if (!ENTER_FLAG && !ENTER_FLAG_2 && !ENTER_FLAG_3){
-		TERMINAL_READ = 1;
-		goto LOOP;
+	/* Waiting for user to press enter, terminal_newline wakes us */
+	while (!*entered) {
+		sleep_on(&term->read_queue);
 	}
 
 	/* Set enter flag to 0, write to buffer, and set read flag to 0 */
-	ENTER_FLAG = 0;
-	ENTER_FLAG_2 = 0;
-	ENTER_FLAG_3 = 0;
+	*entered = 0;
 	for (i = 0; (i < nbytes && i < BUFFER_SIZE); i++) {
-		*((uint8_t*)buf + i) = terminals[curr_terminal].keyboard_buf[i];
+		*((uint8_t*)buf + i) = term->keyboard_buf[i];
 	}
 	TERMINAL_READ = 0;
 
 	/* End critical section */
-	sti();
+	restore_flags(flags);
 
 	/* Return number of bytes read */
-	if (nbytes < terminals[cur_task->on_term].term_buf_index) {
+	if (nbytes < term->term_buf_index) {
 		return nbytes;
 	}
 	else {
-		return terminals[cur_task->on_term].term_buf_index + 1;
+		return term->term_buf_index + 1;
 	}
 }
 
@@ -96,8 +110,8 @@ int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes) {
 	/* Check if current process is on the active terminal, if not write to back page */
 	cur_task = get_pcb();
 	if (cur_task->on_term != curr_terminal)	{
-		first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (cur_task->on_term+1) * (FOUR_KB)) | 0x3;
-		flushTLB();
+		first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (cur_task->on_term+1) * (FOUR_KB)) | 0x103;
+		flushTLBEntry(VIDEO_MEMORY);
 	}
 
 	/* Writing data from buf to the terminal buffer */
@@ -130,8 +144,8 @@ int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes) {
 	/* Change page to point back to video memory */
 	clear_buffer();
 	if (cur_task->on_term != curr_terminal){
-		first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x3;
-		flushTLB();
+		first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x103;
+		flushTLBEntry(VIDEO_MEMORY);
 	}
 
 	/* End critical section, restore flags */
@@ -184,13 +198,13 @@ void init_terminals(void)
 	curr_terminal = 0;
 	/* setting up video paging for all 3 terminals */
 	memcpy(&(term_vid_buf), (int8_t *)video_mem, NUM_ROWS * NUM_COLS * 2);
-	first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (curr_terminal+1) * (FOUR_KB)) | 0x3;
-	flushTLB();
+	first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (curr_terminal+1) * (FOUR_KB)) | 0x103;
+	flushTLBEntry(VIDEO_MEMORY);
 	memcpy((int8_t *)video_mem, &(term_vid_buf), NUM_ROWS * NUM_COLS * 2);
 
 	/* write first page for video memory */
-	first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x3;
-	flushTLB();
+	first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x103;
+	flushTLBEntry(VIDEO_MEMORY);
 
 	/* set up all terminal struct elements */
 	terminals[curr_terminal].term_index = index;
@@ -202,8 +216,8 @@ void init_terminals(void)
 
 	/* initialize each video memory page for separate terminals */
 	for (i = 1; i < MAX_TERMS; i++){
-		first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (i+1) * (FOUR_KB)) | 0x3;
-		flushTLB();
+		first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (i+1) * (FOUR_KB)) | 0x103;
+		flushTLBEntry(VIDEO_MEMORY);
 		clear();
 		terminals[i].term_index = 0;
 		memset(&(terminals[i].keyboard_buf), 0, BUFFER_SIZE);
@@ -212,8 +226,8 @@ void init_terminals(void)
 		terminals[i].term_screen_y = 0;
 		terminals[i].vid_map_flag = 0;
 	}
-	first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x3;
-	flushTLB();
+	first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x103;
+	flushTLBEntry(VIDEO_MEMORY);
 }
 
 /*
@@ -245,13 +259,15 @@ void update_terminal(void)
  */
 void switch_terminal(const int term_dest)
 {
+	uint32_t pid;
+
 	cli();
 	cur_task = get_pcb();
 
 	/* Saving back information */
 	memcpy(&(term_vid_buf), (int8_t *)video_mem, NUM_ROWS * NUM_COLS * 2);
-	first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (curr_terminal+1) * (FOUR_KB)) | 0x3;
-	flushTLB();
+	first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (curr_terminal+1) * (FOUR_KB)) | 0x103;
+	flushTLBEntry(VIDEO_MEMORY);
 	memcpy((int8_t *)video_mem, &(term_vid_buf), NUM_ROWS * NUM_COLS * 2);
 
 	/* Saving keyboard input buffer */
@@ -266,23 +282,25 @@ void switch_terminal(const int term_dest)
 
 
 	/* Restoring desired terminal information */
-	if (terminals[term_dest].vid_map_flag == 0)
+	/* Processes of the new terminal draw to the screen through vidmap,
+	 * processes of the old one to its backing page
+	 */
+	for (pid = 0; pid < MAX_PIDS; pid++)
 	{
-		if (terminals[curr_terminal].vid_map_flag == 1)
-		{
-			user_vidmem_page_table[0] = (uint32_t) (VIDEO_MEMORY + (curr_terminal+1) * (FOUR_KB)) | 0x7;
-		}
-	}
-	else{
-		user_vidmem_page_table[0] = (uint32_t) VIDEO_MEMORY | 0x7;
+		if (pcb_arr[pid] == NULL)
+			continue;
+		if (pcb_arr[pid]->on_term == term_dest)
+			set_user_vidmap(pcb_arr[pid], VIDEO_MEMORY);
+		else if (pcb_arr[pid]->on_term == curr_terminal)
+			set_user_vidmap(pcb_arr[pid], VIDEO_MEMORY + (curr_terminal+1) * (FOUR_KB));
 	}
 
 	/* Setting up video paging to switch to desired terminal video address */
-	first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (term_dest+1) * (FOUR_KB)) | 0x3;
-	flushTLB();
+	first_page_table[184] = (uint32_t) (VIDEO_MEMORY + (term_dest+1) * (FOUR_KB)) | 0x103;
+	flushTLBEntry(VIDEO_MEMORY);
 	memcpy(&(term_vid_buf), (int8_t *)video_mem, NUM_ROWS * NUM_COLS * 2);
-	first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x3;
-	flushTLB();
+	first_page_table[184] = (uint32_t) VIDEO_MEMORY | 0x103;
+	flushTLBEntry(VIDEO_MEMORY);
 
 	/* Restoring backing information */
 	memcpy((int8_t *)video_mem, &(term_vid_buf), NUM_ROWS * NUM_COLS * 2);
@@ -541,28 +559,13 @@ void terminal_puts(int32_t nbytes) {
 void terminal_newline(void) {
 	cur_task = get_pcb();
 	uint32_t flags;
-	/* Set enter flag to 1 and append a new line to buffer */
+	/* Set this terminal's enter flag and append a new line to buffer. The other
+	 * terminals keep theirs, their readers may not have run yet
+	 */
 		cli_and_save(flags);
-		switch(curr_terminal){
-			case 0:
-				ENTER_FLAG = 1;
-				ENTER_FLAG_2 = 0;
-				ENTER_FLAG_3 = 0;
-				break;
-			case 1:
-				ENTER_FLAG_2 = 1;
-				ENTER_FLAG_3 = 0;
-				ENTER_FLAG = 0;
-				break;
-			case 2:
-				ENTER_FLAG_3 = 1;
-				ENTER_FLAG_2 = 0;
-				ENTER_FLAG = 0;
-				break;
-			default:
-				break;
-		}
+		*enter_flag(curr_terminal) = 1;
 		terminals[curr_terminal].keyboard_buf[terminals[curr_terminal].term_buf_index] = '\n';
+		wake_up(&terminals[curr_terminal].read_queue);
 
 		/* Check if we need to scroll, if not make a new line */
 		if (terminals[curr_terminal].term_index >= 1920) {
@@ -34,8 +34,9 @@ typedef struct terminal{
     volatile uint16_t term_buf_index;
     int term_screen_x;
     int term_screen_y;
-    uint8_t active_pid;
+    uint32_t active_pid;
     uint8_t vid_map_flag;
+    wait_queue_t read_queue;    /* terminal_read callers waiting for enter */
 }terminal_t;
 
 uint8_t term_vid_buf[NUM_ROWS * NUM_COLS * 2];
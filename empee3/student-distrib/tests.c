@@ -7,6 +7,10 @@
 #include "filesys.h"
 #include "terminal.h"
 #include "syscalls.h"
+#include "imgcache.h"
+#include "frame.h"
+#include "kmalloc.h"
+#include "pit.h"
 
 #define PASS 1
 #define FAIL 0
@@ -344,6 +348,598 @@ int rtc_test2() {
 	return PASS;
 }
 
+/*
+ * name_index_test
+ *   DESCRIPTION: Looks up every dentry by name through the name index
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if every name resolves to its own dentry
+ *   SIDE EFFECTS: Prints the probe counters
+ */
+int name_index_test() {
+    TEST_HEADER;
+    dentry_t tmp_dentry;
+    int8_t name[FILENAME_LEN+1];
+    uint32_t idx;
+    int result = PASS;
+
+    for(idx = 0; idx < boot_block.dir_count; idx++) {
+        strncpy(name, (dentries+idx)->filename, FILENAME_LEN);
+        name[FILENAME_LEN] = '\0';
+        if((read_dentry_by_name((const uint8_t*) name, &tmp_dentry) == -1) ||
+           (tmp_dentry.inode_num != (dentries+idx)->inode_num))
+            result = FAIL;
+    }
+
+    /* Names that are not in the directory must miss */
+    if(read_dentry_by_name((const uint8_t*) "nosuchfile", &tmp_dentry) != -1)
+        result = FAIL;
+
+    printf("lookups: %d, probes: %d, max probe: %d\n",
+            name_lookups, name_probes, name_max_probe);
+
+    return result;
+}
+
+/*
+ * bcache_test
+ *   DESCRIPTION: Reads the same file twice and checks the second pass hits the block cache
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if the second read was served from the cache
+ *   SIDE EFFECTS: Prints the cache counters
+ */
+int bcache_test() {
+    TEST_HEADER;
+    dentry_t tmp_dentry;
+    uint8_t buf[BLOCK_SIZE];
+    uint32_t hits;
+    int result = PASS;
+
+    if(read_dentry_by_name((const uint8_t*) "shell", &tmp_dentry) == -1)
+        return FAIL;
+
+    read_data(tmp_dentry.inode_num, 0, buf, BLOCK_SIZE);
+    hits = bcache_hits;
+    read_data(tmp_dentry.inode_num, 0, buf, BLOCK_SIZE);
+    if(bcache_hits == hits)
+        result = FAIL;
+
+    printf("hits: %d, misses: %d\n", bcache_hits, bcache_misses);
+
+    return result;
+}
+
+/* Chunk sizes for large_file_test, odd sizes straddle block boundaries */
+static uint32_t chunk_sizes[] = {1, 7, 100, 4095, 4096, 5000, 12288, 40000};
+static uint8_t large_buf[40000];
+
+/* Reads the time stamp counter */
+static inline uint32_t read_tsc() {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return low;
+}
+
+/*
+ * large_file_test
+ *   DESCRIPTION: Streams the largest file in the image (bigger than
+ *                verylargetextwithverylongname.txt) with several chunk sizes
+ *                and compares a checksum against the data blocks themselves
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if every chunk size reads back the same bytes and position
+ *   SIDE EFFECTS: Prints cycles per kB for each chunk size
+ */
+int large_file_test() {
+    TEST_HEADER;
+    dentry_t tmp_dentry;
+    uint32_t inode = 0;
+    uint32_t length = 0;
+    uint32_t expected = 0;
+    uint32_t sum, pos, start, cycles;
+    int32_t bytesRead;
+    uint32_t i, j;
+    int result = PASS;
+
+    /* Find the largest regular file (stored raw, the checksum reads its blocks) */
+    for(i = 0; read_dentry_by_index(i, &tmp_dentry) == 0; i++) {
+        if((tmp_dentry.filetype == REG_FILE) && !(fmeta[tmp_dentry.inode_num].flags & INODE_COMPRESSED) &&
+           (fmeta[tmp_dentry.inode_num].size > length)) {
+            inode = tmp_dentry.inode_num;
+            length = fmeta[inode].size;
+        }
+    }
+
+    /* Reference checksum straight from the data blocks */
+    for(pos = 0; pos < length; pos++)
+        expected += fs_block(inode, pos / BLOCK_SIZE)[pos % BLOCK_SIZE] * (pos + 1);
+
+    for(i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+        sum = 0;
+        pos = 0;
+        cycles = 0;
+        while(1) {
+            /* Only time the read itself */
+            start = read_tsc();
+            bytesRead = read_data(inode, pos, large_buf, chunk_sizes[i]);
+            cycles += read_tsc() - start;
+            if(bytesRead <= 0)
+                break;
+
+            for(j = 0; j < bytesRead; j++)
+                sum += large_buf[j] * (pos + j + 1);
+            pos += bytesRead;
+        }
+
+        if((sum != expected) || (pos != length))
+            result = FAIL;
+        printf("%d bytes in chunks of %d: %d cycles/kB\n", length, chunk_sizes[i], cycles / (length / 1024 + 1));
+    }
+
+    return result;
+}
+
+/*
+ * fs_write_test
+ *   DESCRIPTION: Creates a file, appends to it across block boundaries, reads it
+ *                back, truncates and unlinks it
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if the data reads back and every block is freed again
+ *   SIDE EFFECTS: Uses large_buf, leaves the file system as it found it
+ */
+int fs_write_test() {
+    TEST_HEADER;
+    dentry_t tmp_dentry;
+    uint32_t free_blocks = fs_free_blocks;
+    uint32_t pos, i;
+    int result = PASS;
+
+    if(fs_create((const uint8_t*) "write_test") == -1)
+        return FAIL;
+    if(read_dentry_by_name((const uint8_t*) "write_test", &tmp_dentry) == -1)
+        return FAIL;
+
+    /* Append in odd sized chunks */
+    for(i = 0; i < sizeof(large_buf); i++)
+        large_buf[i] = (uint8_t) (i * 7);
+    for(pos = 0; pos < sizeof(large_buf); pos += 5000)
+        write_data(tmp_dentry.inode_num, pos, large_buf + pos,
+                   (sizeof(large_buf) - pos < 5000) ? sizeof(large_buf) - pos : 5000);
+
+    memset(large_buf, 0, sizeof(large_buf));
+    if(read_data(tmp_dentry.inode_num, 0, large_buf, sizeof(large_buf)) != sizeof(large_buf))
+        result = FAIL;
+    for(i = 0; i < sizeof(large_buf); i++) {
+        if(large_buf[i] != (uint8_t) (i * 7))
+            result = FAIL;
+    }
+
+    /* Shrink to one block, then remove */
+    fs_truncate(tmp_dentry.inode_num, 100);
+    if((inodes + tmp_dentry.inode_num)->length != 100)
+        result = FAIL;
+    if((fs_unlink((const uint8_t*) "write_test") == -1) || (fs_free_blocks != free_blocks))
+        result = FAIL;
+
+    return result;
+}
+
+/*
+ * unlink_busy_test
+ *   DESCRIPTION: Unlinks and truncates a file that is still in use: a pinned file
+ *                cannot shrink, an unlinked one keeps its blocks and inode until
+ *                its last reference is dropped
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if the blocks are only freed by the last fs_inode_put
+ *   SIDE EFFECTS: Leaves the file system as it found it
+ */
+int unlink_busy_test() {
+    TEST_HEADER;
+    dentry_t tmp_dentry;
+    uint32_t free_blocks = fs_free_blocks;
+    uint8_t data[BLOCK_SIZE];
+    int result = PASS;
+
+    if(fs_create((const uint8_t*) "busy_test") == -1)
+        return FAIL;
+    if(read_dentry_by_name((const uint8_t*) "busy_test", &tmp_dentry) == -1)
+        return FAIL;
+    memset(data, 0x5A, BLOCK_SIZE);
+    if(write_data(tmp_dentry.inode_num, 0, data, BLOCK_SIZE) != BLOCK_SIZE)
+        result = FAIL;
+
+    /* Pinned like an mmap: no shrinking, and unlink only drops the name */
+    fs_inode_get(tmp_dentry.inode_num, 1);
+    if(fs_truncate(tmp_dentry.inode_num, 0) != -1)
+        result = FAIL;
+    if((fs_unlink((const uint8_t*) "busy_test") == -1) || (fs_free_blocks == free_blocks))
+        result = FAIL;
+    if(read_dentry_by_name((const uint8_t*) "busy_test", &tmp_dentry) != -1)
+        result = FAIL;
+    memset(data, 0, BLOCK_SIZE);
+    if((read_data(tmp_dentry.inode_num, 0, data, BLOCK_SIZE) != BLOCK_SIZE) || (data[BLOCK_SIZE - 1] != 0x5A))
+        result = FAIL;
+
+    fs_inode_put(tmp_dentry.inode_num, 1);
+    if(fs_free_blocks != free_blocks)
+        result = FAIL;
+
+    return result;
+}
+
+/*
+ * image_cache_test
+ *   DESCRIPTION: Takes two references on the shell image and checks they share
+ *                one cache slot, that the first page is text and its frame is reused
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if both references see the same frames
+ *   SIDE EFFECTS: Leaves the shell image cached
+ */
+int image_cache_test() {
+    TEST_HEADER;
+    dentry_t tmp_dentry;
+    uint32_t size;
+    int32_t first, second;
+    int result = PASS;
+
+    if(read_dentry_by_name((const uint8_t*) "shell", &tmp_dentry) == -1)
+        return FAIL;
+    size = (inodes + tmp_dentry.inode_num)->length;
+
+    first = image_cache_get(tmp_dentry.inode_num, size);
+    second = image_cache_get(tmp_dentry.inode_num, size);
+    if((first == NO_IMAGE_SLOT) || (first != second))
+        result = FAIL;
+    else if(!image_cache_is_text(first, 0) ||
+            (image_cache_page(first, 0) != image_cache_page(second, 0)))
+        result = FAIL;
+
+    image_cache_put(first);
+    image_cache_put(second);
+
+    return result;
+}
+
+/*
+ * frame_test
+ *   DESCRIPTION: Allocates single frames and a kernel stack run, checks they are
+ *                distinct, aligned and writable, then frees them again
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if the free count is back where it started
+ *   SIDE EFFECTS: none
+ */
+int frame_test() {
+    TEST_HEADER;
+    uint32_t before = frames_free;
+    uint32_t a, b, run;
+    int result = PASS;
+
+    a = frame_alloc();
+    b = frame_alloc();
+    run = frame_alloc_run(KSTACK_FRAMES);
+    if((a == NO_FRAME) || (b == NO_FRAME) || (run == NO_FRAME) || (a == b))
+        result = FAIL;
+    else if((run & (EIGHT_KB - 1)) || (frames_free != before - 2 - KSTACK_FRAMES))
+        result = FAIL;
+    else {
+        /* Frames are identity mapped for the kernel */
+        memset((void*) a, 0xA5, FOUR_KB);
+        memset((void*) run, 0x5A, EIGHT_KB);
+        if((*(uint8_t*) (a + FOUR_KB - 1) != 0xA5) || (*(uint8_t*) run != 0x5A))
+            result = FAIL;
+    }
+
+    frame_free(a);
+    frame_free(b);
+    frame_free_run(run, KSTACK_FRAMES);
+    if(frames_free != before)
+        result = FAIL;
+
+    return result;
+}
+
+/*
+ * kmalloc_test
+ *   DESCRIPTION: Allocates from a size class, the file cache and the large path,
+ *                checks a freed object is handed out again and counters balance
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if the heap behaves like a set of free lists
+ *   SIDE EFFECTS: none
+ */
+int kmalloc_test() {
+    TEST_HEADER;
+    uint32_t in_use = file_cache.in_use;
+    uint32_t before = frames_free;
+    uint8_t* small;
+    uint8_t* big;
+    file_t* file;
+    void* again;
+    int result = PASS;
+
+    small = kmalloc(100);
+    file = kmem_cache_alloc(&file_cache);
+    big = kmalloc(3 * FOUR_KB);
+    if((small == NULL) || (file == NULL) || (big == NULL))
+        return FAIL;
+
+    /* Large allocations are page aligned runs */
+    if(((uint32_t) big & (FOUR_KB - 1)) || (file_cache.in_use != in_use + 1))
+        result = FAIL;
+    memset(small, 0xA5, 100);
+    memset(big, 0x5A, 3 * FOUR_KB);
+
+    /* Free lists are LIFO */
+    kfree(small);
+    again = kmalloc(128);
+    if(again != small)
+        result = FAIL;
+    kfree(again);
+
+    kfree(file);
+    kfree(big);
+    if(file_cache.in_use != in_use)
+        result = FAIL;
+
+    /* Only slabs grown for the first allocations stay out of the frame pool */
+    if(frames_free + 2 < before)
+        result = FAIL;
+
+    return result;
+}
+
+/*
+ * pid_test
+ *   DESCRIPTION: Takes more pids than the old fixed table had, checks they are
+ *                distinct and taken, then frees them
+ *   INPUTS:
+ *   OUTPUTS: none
+ *   RETURN VALUE: PASS if every pid is unique and the task count balances
+ *   SIDE EFFECTS: Moves the pid hint
+ */
+int pid_test() {
+    TEST_HEADER;
+    int32_t pids[40];
+    uint32_t tasks = nr_tasks;
+    int i, j;
+    int result = PASS;
+
+    for(i = 0; i < 40; i++) {
+        pids[i] = pid_alloc();
+        if((pids[i] == NO_PID) || !pid_in_use(pids[i]))
+            result = FAIL;
+        for(j = 0; j < i; j++) {
+            if(pids[j] == pids[i])
+                result = FAIL;
+        }
+    }
+
+    for(i = 0; i < 40; i++)
+        pid_free(pids[i]);
+    if(nr_tasks != tasks)
+        result = FAIL;
+
+    return result;
+}
+
+/* tlb_test
+ * Remaps the video page to a backing page and back with single page
+ * invalidations, a stale translation would send the second write to video memory
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: Overwrites the first character cell of terminal 0's backing page
+ * Coverage: flushTLBEntry, TLB counters
+ * Files: paging.c/h, paging_asm.S
+ */
+int tlb_test() {
+    TEST_HEADER;
+    volatile uint8_t* video = (uint8_t*) VIDEO_MEMORY;
+    uint32_t entry = first_page_table[184];
+    uint32_t flushes = tlb_flushes;
+    uint32_t page_flushes = tlb_page_flushes;
+    uint8_t saved;
+    int result = PASS;
+
+    cli();
+    saved = video[0];
+    video[0] = 'X';
+
+    first_page_table[184] = (uint32_t) (VIDEO_MEMORY + FOUR_KB) | 0x103;
+    flushTLBEntry(VIDEO_MEMORY);
+    video[0] = 'Y';
+
+    first_page_table[184] = entry;
+    flushTLBEntry(VIDEO_MEMORY);
+    if(video[0] != 'X')
+        result = FAIL;
+    video[0] = saved;
+    sti();
+
+    if((tlb_page_flushes != page_flushes + 2) || (tlb_flushes != flushes))
+        result = FAIL;
+
+    return result;
+}
+
+/* page_dir_test
+ * Builds a page directory for a fake process, maps a stack page and tears it down
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None (every frame is given back)
+ * Coverage: create_page_directory, user_pte, free_user_pages
+ * Files: paging.c/h
+ */
+int page_dir_test() {
+    TEST_HEADER;
+    pcb_t pcb;
+    uint32_t free = frames_free;
+    uint32_t* pte;
+    uint32_t frame;
+    int i;
+    int result = PASS;
+
+    memset((void*) &pcb, 0, sizeof(pcb_t));
+    if(create_page_directory(&pcb) == -1)
+        return FAIL;
+
+    /* Kernel entries are shared, user entries start out empty */
+    for(i = 0; i < 1024; i++) {
+        if((i < USER_PDE) && (pcb.page_dir[i] != page_directory[i]))
+            result = FAIL;
+        if((i >= USER_PDE) && (i <= VIDMAP_PDE) && (pcb.page_dir[i] != 0))
+            result = FAIL;
+    }
+
+    if(user_pte(&pcb, USER_STACK, 0) != NULL)
+        result = FAIL;
+    pte = user_pte(&pcb, USER_STACK, 1);
+    if((pte == NULL) || (*pte != 0) || !(pcb.page_dir[USER_STACK / FOUR_MB] & 0x1))
+        result = FAIL;
+
+    /* An owned page goes back with the page table and the directory */
+    if((pte != NULL) && ((frame = frame_alloc()) != NO_FRAME))
+        *pte = frame | PTE_OWNED | 0x7;
+
+    free_user_pages(&pcb);
+    if((pcb.page_dir != NULL) || (frames_free != free))
+        result = FAIL;
+
+    return result;
+}
+
+/* cow_copy_test
+ * Shares a fake process' page with a copy of its page tables, as fork does,
+ * and tears both down
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None (every frame is given back)
+ * Coverage: copy_user_pages, frame_share, frame_shared, frame_free
+ * Files: paging.c/h, frame.c/h
+ */
+int cow_copy_test() {
+    TEST_HEADER;
+    pcb_t parent, child;
+    uint32_t free = frames_free;
+    uint32_t* pte;
+    uint32_t frame = NO_FRAME;
+    int result = PASS;
+
+    memset((void*) &parent, 0, sizeof(pcb_t));
+    memset((void*) &child, 0, sizeof(pcb_t));
+    if(create_page_directory(&parent) == -1)
+        return FAIL;
+    if(((pte = user_pte(&parent, USER_STACK, 1)) != NULL) && ((frame = frame_alloc()) != NO_FRAME))
+        *pte = frame | PTE_OWNED | 0x7;
+    if(frame == NO_FRAME) {
+        free_user_pages(&parent);
+        return FAIL;
+    }
+
+    /* Both sides map the frame read only, and it has two owners */
+    if(copy_user_pages(&parent, &child) == -1)
+        result = FAIL;
+    else if((*pte & 0x2) || !(*pte & PTE_COW) || !frame_shared(frame) ||
+            (*user_pte(&child, USER_STACK, 0) != *pte))
+        result = FAIL;
+
+    /* The first owner to go leaves the frame to the other one */
+    free_user_pages(&child);
+    if(frame_shared(frame) || (frames_free == free))
+        result = FAIL;
+
+    free_user_pages(&parent);
+    if(frames_free != free)
+        result = FAIL;
+
+    return result;
+}
+
+/* tunable_test
+ * Sets the scheduler tunables the way the stats file and the command line do
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None (the old values are put back)
+ * Coverage: stats_set_text, stats_write, sched_set_quantum, pit_set_hz
+ * Files: stats.c/h, schedule.c/h, pit.c/h
+ */
+int tunable_test() {
+    TEST_HEADER;
+    uint32_t quantum = sched_quantum;
+    uint32_t hz = pit_hz;
+    int8_t text[] = "sched_quantum=7\npit_hz=100";
+    int result = PASS;
+
+    if((stats_set_text(text, strlen(text), 0) != 0) || (sched_quantum != 7) || (pit_hz != 100))
+        result = FAIL;
+
+    /* Out of range values, counters and unknown names are rejected */
+    if((stats_set_text("sched_quantum=0", 15, 0) != 1) || (sched_quantum != 7))
+        result = FAIL;
+    if((stats_set_text("pit_interrupts=5 nope=1 pit_hz=12x", 34, 0) != 3) || (pit_hz != 100))
+        result = FAIL;
+
+    /* The command line has words for others, the file write takes no garbage */
+    if((stats_set_text("root=/dev/hda sched_quantum=3", 29, 1) != 0) || (sched_quantum != 3))
+        result = FAIL;
+    if(stats_write(0, "sched_quantum", 13) != -1)
+        result = FAIL;
+
+    sched_set_quantum(quantum);
+    pit_set_hz(hz);
+    return result;
+}
+
+#define SWITCH_TEST_WORDS   256
+
+static uint32_t switch_test_stack[SWITCH_TEST_WORDS];
+static pcb_t switch_test_pcb;
+static uint32_t switch_test_back;
+static volatile uint32_t switch_test_runs;
+
+/* Counts a run and switches back to switch_test, each time it is switched to */
+static void switch_test_entry(void) {
+    while(1) {
+        switch_test_runs++;
+        switch_to(&switch_test_pcb.kernel_stack, switch_test_back);
+    }
+}
+
+/* switch_test
+ * Switches to a frame built by task_stack_init and back, twice
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None (interrupts are off while on the test stack)
+ * Coverage: switch_to, task_stack_init
+ * Files: switch_asm.S, schedule.c/h
+ */
+int switch_test() {
+    TEST_HEADER;
+    uint32_t stack_top = (uint32_t) &switch_test_stack[SWITCH_TEST_WORDS - 1];
+    uint32_t flags, sp;
+    int result = PASS;
+
+    cli_and_save(flags);
+    switch_test_runs = 0;
+    task_stack_init(&switch_test_pcb, stack_top, switch_test_entry);
+
+    /* The first switch enters switch_test_entry, the second resumes it */
+    switch_to(&switch_test_back, switch_test_pcb.kernel_stack);
+    sp = switch_test_pcb.kernel_stack;
+    if((switch_test_runs != 1) || (sp <= (uint32_t) switch_test_stack) || (sp >= stack_top))
+        result = FAIL;
+    switch_to(&switch_test_back, switch_test_pcb.kernel_stack);
+    if((switch_test_runs != 2) || (switch_test_pcb.kernel_stack != sp))
+        result = FAIL;
+    restore_flags(flags);
+
+    return result;
+}
+
 /* Checkpoint 3 tests */
 int syscall_linker_test() {
 	TEST_HEADER;
@@ -389,6 +985,20 @@ void launch_tests(){
     // TEST_OUTPUT("file_print_test", file_print_test());
     // TEST_OUTPUT("dir_read_test", dir_read_test());
     // TEST_OUTPUT("read_by_index_test", read_by_index_test());
+    // TEST_OUTPUT("name_index_test", name_index_test());
+    // TEST_OUTPUT("bcache_test", bcache_test());
+    // TEST_OUTPUT("large_file_test", large_file_test());
+    // TEST_OUTPUT("fs_write_test", fs_write_test());
+    // TEST_OUTPUT("unlink_busy_test", unlink_busy_test());
+    // TEST_OUTPUT("image_cache_test", image_cache_test());
+    // TEST_OUTPUT("frame_test", frame_test());
+    // TEST_OUTPUT("kmalloc_test", kmalloc_test());
+    // TEST_OUTPUT("pid_test", pid_test());
+    // TEST_OUTPUT("tlb_test", tlb_test());
+    // TEST_OUTPUT("page_dir_test", page_dir_test());
+    // TEST_OUTPUT("cow_copy_test", cow_copy_test());
+    // TEST_OUTPUT("tunable_test", tunable_test());
+    // TEST_OUTPUT("switch_test", switch_test());
     // TEST_OUTPUT("Terminal Test", terminal_test());
 
     /* Checkpoint 3 */
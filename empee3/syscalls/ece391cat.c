@@ -7,6 +7,9 @@ int main ()
 {
     int32_t fd, cnt;
     uint8_t buf[1024];
+    uint8_t* data;
+    ece391_stat_t st;
+    uint32_t left;
 
     if (0 != ece391_getargs (buf, 1024)) {
         ece391_fdputs (1, (uint8_t*)"could not read arguments\n");
@@ -18,6 +21,27 @@ int main ()
 	return 2;
     }
 
+    /* Regular files are mapped and written out without a copy */
+    if (-1 != (cnt = ece391_mmap (fd, &data))) {
+        if (0 != cnt && -1 == ece391_write (1, data, cnt))
+            return 3;
+        return 0;
+    }
+
+    /* Regular files stop at their size instead of reading until EOF */
+    if (0 == ece391_fstat (fd, &st) && 2 == st.type) {
+        for (left = st.size; 0 != left; left -= cnt) {
+	    cnt = ece391_read (fd, buf, (left < 1024) ? left : 1024);
+	    if (0 >= cnt) {
+	        ece391_fdputs (1, (uint8_t*)"file read failed\n");
+		return 3;
+	    }
+	    if (-1 == ece391_write (1, buf, cnt))
+	        return 3;
+	}
+	return 0;
+    }
+
     while (0 != (cnt = ece391_read (fd, buf, 1024))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"file read failed\n");
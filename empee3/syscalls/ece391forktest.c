@@ -0,0 +1,64 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * Forks a few workers that each write their own pattern over a shared
+ * buffer (copy on write), checks that the parent's copy is unchanged, then
+ * waits for the workers and prints their halt statuses
+ */
+
+#define WORKERS 4
+#define BUF_LEN 8192
+
+static uint8_t shared[BUF_LEN];
+
+static int32_t worker (uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < BUF_LEN; i++)
+        shared[i] = n;
+    for (i = 0; i < BUF_LEN; i++) {
+        if (shared[i] != n)
+            return 1;
+    }
+    return 10 + n;
+}
+
+int main ()
+{
+    uint8_t buf[16];
+    int32_t pid, status;
+    uint32_t i;
+
+    for (i = 0; i < BUF_LEN; i++)
+        shared[i] = 0xFF;
+
+    for (i = 0; i < WORKERS; i++) {
+        if (-1 == (pid = ece391_fork ())) {
+            ece391_fdputs (1, (uint8_t*)"fork failed\n");
+            return 2;
+        }
+        if (0 == pid)
+            ece391_halt (worker (i));
+    }
+
+    while (-1 != (pid = ece391_wait (&status))) {
+        ece391_fdputs (1, (uint8_t*)"pid ");
+        ece391_fdputs (1, ece391_itoa (pid, buf, 10));
+        ece391_fdputs (1, (uint8_t*)" halted with ");
+        ece391_fdputs (1, ece391_itoa (status, buf, 10));
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+
+    for (i = 0; i < BUF_LEN; i++) {
+        if (0xFF != shared[i]) {
+            ece391_fdputs (1, (uint8_t*)"parent memory changed\n");
+            return 3;
+        }
+    }
+    ece391_fdputs (1, (uint8_t*)"parent memory intact\n");
+    return 0;
+}
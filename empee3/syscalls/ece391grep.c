@@ -6,6 +6,37 @@
 #define BUFSIZE 1024
 #define SBUFSIZE 33
 
+int32_t
+do_one_mapped (const char* s, const char* fname, int32_t fd)
+{
+    int32_t len, line_start, line_end, line_len, check, s_len;
+    uint8_t* data;
+
+    if (-1 == (len = ece391_mmap (fd, &data)))
+        return -1;
+
+    s_len = ece391_strlen ((uint8_t*)s);
+    for (line_start = 0; line_start < len; line_start = line_end + 1) {
+        line_end = line_start;
+	while (line_end < len && '\n' != data[line_end])
+	    line_end++;
+	/* the mapping is read-only, so lines end at a NUL instead of getting one */
+	for (line_len = 0; line_start + line_len < line_end &&
+	     '\0' != data[line_start + line_len]; line_len++);
+	for (check = line_start; check + s_len <= line_start + line_len; check++) {
+	    if (s[0] == data[check] &&
+		0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
+		ece391_fdputs (1, (uint8_t*)fname);
+		ece391_fdputs (1, (uint8_t*)":");
+		ece391_write (1, data + line_start, line_len);
+		ece391_fdputs (1, (uint8_t*)"\n");
+		break;
+	    }
+	}
+    }
+    return 0;
+}
+
 int32_t
 do_one_file (const char* s, const char* fname) 
 {
@@ -17,6 +48,13 @@ do_one_file (const char* s, const char* fname)
         ece391_fdputs (1, (uint8_t*)"file open failed\n");
         return -1;
     }
+    if (0 == do_one_mapped (s, fname, fd)) {
+        if (-1 == ece391_close (fd)) {
+            ece391_fdputs (1, (uint8_t*)"file close failed\n");
+            return -1;
+        }
+        return 0;
+    }
     last = 0;
     while (1) {
         cnt = ece391_read (fd, data + last, BUFSIZE - last);
@@ -70,6 +108,7 @@ int main ()
     int32_t fd, cnt;
     uint8_t buf[SBUFSIZE];
     uint8_t search[BUFSIZE];
+    ece391_stat_t st;
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
         ece391_fdputs (1, (uint8_t*)"could not read argument\n");
@@ -89,6 +128,9 @@ int main ()
 	if ('.' == buf[0]) /* a directory... */
 	    continue;
 	buf[cnt] = '\0';
+	/* only regular files with something in them are worth opening */
+	if (0 == ece391_stat (buf, &st) && (2 != st.type || 0 == st.size))
+	    continue;
 	if (0 != do_one_file ((char*)search, (char*)buf))
 	    return 3;
     }
@@ -3,25 +3,33 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define NUM_RECORDS 16
+#define FILENAME_LEN 32
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, i, len, out_len;
+    ece391_dirent_t recs[NUM_RECORDS];
+    uint8_t out[NUM_RECORDS * (FILENAME_LEN + 1)];
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* One read and one write per batch of records */
+    while (0 != (cnt = ece391_getdents (fd, recs, sizeof (recs)))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
+	    out_len = 0;
+	    for (i = 0; i < cnt / sizeof (recs[0]); i++) {
+	        for (len = 0; len < FILENAME_LEN && '\0' != recs[i].name[len]; len++)
+	            out[out_len++] = recs[i].name[len];
+	        out[out_len++] = '\n';
+	    }
+	    if (-1 == ece391_write (1, out, out_len))
 	        return 3;
     }
 
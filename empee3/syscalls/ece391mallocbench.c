@@ -0,0 +1,114 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * Measures ece391_malloc/ece391_free throughput in TSC cycles per operation
+ * for a few allocation patterns, and how much heap each pattern needed
+ */
+
+#define SLOTS       512
+#define LIFO_OPS    20000
+#define BATCH_ROUNDS 10
+#define RANDOM_OPS  20000
+#define LARGE_SIZE  16384
+#define LARGE_COUNT 64
+
+static void* slots[SLOTS];
+static uint32_t seed = 1;
+
+static uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+static uint32_t rand_next (void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+static void report (const char* name, uint32_t cycles, uint32_t ops, uint8_t* heap_start)
+{
+    uint8_t buf[16];
+
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_fdputs (1, (uint8_t*)": ");
+    ece391_fdputs (1, ece391_itoa (ops, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" ops, ");
+    ece391_fdputs (1, ece391_itoa (cycles / ops, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" cycles/op, heap ");
+    ece391_fdputs (1, ece391_itoa ((uint8_t*)ece391_sbrk (0) - heap_start, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" bytes\n");
+}
+
+int main ()
+{
+    uint8_t* heap_start = (uint8_t*)ece391_sbrk (0);
+    uint32_t start, i, j, ops;
+    void* p;
+
+    /* Allocate and free one small block: the free list head is reused */
+    start = rdtsc_lo ();
+    for (i = 0; i < LIFO_OPS; i++) {
+        if (NULL == (p = ece391_malloc (32)))
+            goto oom;
+        ece391_free (p);
+    }
+    report ("lifo 32", rdtsc_lo () - start, 2 * LIFO_OPS, heap_start);
+
+    /* Fill every slot with 16 to 271 bytes, then free them all */
+    start = rdtsc_lo ();
+    for (i = 0; i < BATCH_ROUNDS; i++) {
+        for (j = 0; j < SLOTS; j++) {
+            if (NULL == (slots[j] = ece391_malloc (16 + rand_next () % 256)))
+                goto oom;
+        }
+        for (j = 0; j < SLOTS; j++) {
+            ece391_free (slots[j]);
+            slots[j] = NULL;
+        }
+    }
+    report ("batch", rdtsc_lo () - start, 2 * BATCH_ROUNDS * SLOTS, heap_start);
+
+    /* Random mix of small and medium blocks, freed in random order */
+    start = rdtsc_lo ();
+    for (ops = 0; ops < RANDOM_OPS; ops++) {
+        j = rand_next () % SLOTS;
+        if (NULL != slots[j]) {
+            ece391_free (slots[j]);
+            slots[j] = NULL;
+        } else if (NULL == (slots[j] = ece391_malloc (rand_next () % 4 ? rand_next () % 128 : rand_next () % 4096))) {
+            goto oom;
+        }
+    }
+    report ("random", rdtsc_lo () - start, RANDOM_OPS, heap_start);
+    for (j = 0; j < SLOTS; j++) {
+        ece391_free (slots[j]);
+        slots[j] = NULL;
+    }
+
+    /* Large blocks, the first round grows the heap and later rounds reuse it */
+    start = rdtsc_lo ();
+    for (i = 0; i < BATCH_ROUNDS; i++) {
+        for (j = 0; j < LARGE_COUNT; j++) {
+            if (NULL == (slots[j] = ece391_malloc (LARGE_SIZE)))
+                goto oom;
+        }
+        for (j = 0; j < LARGE_COUNT; j++) {
+            ece391_free (slots[j]);
+            slots[j] = NULL;
+        }
+    }
+    report ("large", rdtsc_lo () - start, 2 * BATCH_ROUNDS * LARGE_COUNT, heap_start);
+
+    return 0;
+
+oom:
+    ece391_fdputs (1, (uint8_t*)"out of memory\n");
+    return 2;
+}
@@ -102,3 +102,173 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/*
+ * Heap allocator
+ *
+ * Blocks carry a one-word header: the block size (a multiple of 8, header
+ * included) with bit 0 set when the block is in use and bit 1 set when the
+ * block before it is. Free blocks also keep their size in their last word,
+ * so free() can merge a block with both of its neighbours in constant time.
+ * Free blocks sit on doubly linked lists by size class: exact classes every
+ * 8 bytes up to 128, then one class per power of two. A request first
+ * searches its own class, any block in a larger class fits as is.
+ * Each heap region ends in a zero-sized, in-use header that stops merging.
+ */
+#define HEAP_INUSE      0x1
+#define HEAP_PREV_INUSE 0x2
+#define HEAP_FLAGS      0x7
+#define HEAP_MIN_BLOCK  16
+#define HEAP_SMALL_MAX  128
+#define HEAP_CLASSES    40
+#define HEAP_CHUNK      0x10000
+#define HEAP_PAGE       0x1000
+
+typedef struct heap_block {
+    uint32_t header;
+    struct heap_block* next;
+    struct heap_block* prev;
+} heap_block_t;
+
+static heap_block_t* heap_free_lists[HEAP_CLASSES];
+static uint8_t* heap_end;
+
+#define BLOCK_SIZE(b)   ((b)->header & ~HEAP_FLAGS)
+#define BLOCK_AT(p)     ((heap_block_t*)(p))
+#define NEXT_BLOCK(b)   BLOCK_AT((uint8_t*)(b) + BLOCK_SIZE(b))
+
+static uint32_t heap_class(uint32_t size)
+{
+    uint32_t class = HEAP_SMALL_MAX / 8 - 1;
+
+    if (size <= HEAP_SMALL_MAX)
+        return size / 8 - 2;
+    /* 136 to 255 share a class, then one class per power of two */
+    for (size >>= 8; 0 != size && class < HEAP_CLASSES - 1; size >>= 1)
+        class++;
+    return class;
+}
+
+static void heap_unlink(heap_block_t* b)
+{
+    if (NULL != b->prev)
+        b->prev->next = b->next;
+    else
+        heap_free_lists[heap_class(BLOCK_SIZE(b))] = b->next;
+    if (NULL != b->next)
+        b->next->prev = b->prev;
+}
+
+/* Marks b free, merges it with free neighbours and puts it on its list */
+static void heap_insert(heap_block_t* b)
+{
+    heap_block_t* next = NEXT_BLOCK(b);
+    heap_block_t** list;
+    uint32_t size = BLOCK_SIZE(b);
+
+    if (!(next->header & HEAP_INUSE)) {
+        heap_unlink(next);
+        size += BLOCK_SIZE(next);
+    }
+    if (!(b->header & HEAP_PREV_INUSE)) {
+        b = BLOCK_AT((uint8_t*)b - *((uint32_t*)b - 1));
+        heap_unlink(b);
+        size += BLOCK_SIZE(b);
+    }
+
+    /* The block before a free block is always in use after merging */
+    b->header = size | HEAP_PREV_INUSE;
+    *(uint32_t*)((uint8_t*)b + size - 4) = size;
+    NEXT_BLOCK(b)->header &= ~HEAP_PREV_INUSE;
+
+    list = &heap_free_lists[heap_class(size)];
+    b->prev = NULL;
+    b->next = *list;
+    if (NULL != *list)
+        (*list)->prev = b;
+    *list = b;
+}
+
+/* Adds at least size bytes of free space to the heap, returns 0 on success */
+static int32_t heap_grow(uint32_t size)
+{
+    uint8_t* brk = (uint8_t*)ece391_sbrk(0);
+    uint32_t pad = (HEAP_PAGE - ((uint32_t)brk & (HEAP_PAGE - 1))) & (HEAP_PAGE - 1);
+    uint32_t grow = (size + 8 + HEAP_CHUNK - 1) & ~(HEAP_CHUNK - 1);
+    uint8_t* start = brk + pad;
+    heap_block_t* b;
+
+    if ((int32_t)brk == -1 || -1 == ece391_sbrk(pad + grow))
+        return -1;
+
+    if (start == heap_end) {
+        /* Contiguous with the last region: its end marker heads the new block */
+        b = BLOCK_AT(heap_end - 4);
+        b->header = grow | (b->header & HEAP_PREV_INUSE) | HEAP_INUSE;
+    } else {
+        /* Payloads are 8-byte aligned, so blocks start 4 bytes into the page */
+        b = BLOCK_AT(start + 4);
+        b->header = (grow - 8) | HEAP_PREV_INUSE | HEAP_INUSE;
+    }
+    heap_end = start + grow;
+    BLOCK_AT(heap_end - 4)->header = HEAP_INUSE;
+
+    heap_insert(b);
+    return 0;
+}
+
+static heap_block_t* heap_find(uint32_t size)
+{
+    heap_block_t* b;
+    uint32_t class = heap_class(size);
+
+    /* The own class may hold smaller blocks, larger classes never do */
+    for (b = heap_free_lists[class]; NULL != b; b = b->next) {
+        if (BLOCK_SIZE(b) >= size)
+            return b;
+    }
+    for (class++; class < HEAP_CLASSES; class++) {
+        if (NULL != heap_free_lists[class])
+            return heap_free_lists[class];
+    }
+    return NULL;
+}
+
+void* ece391_malloc(uint32_t nbytes)
+{
+    heap_block_t* b;
+    heap_block_t* rest;
+    uint32_t size;
+
+    if (nbytes > 0x3FFFFFF0)
+        return NULL;
+    size = (nbytes + 4 + 7) & ~7;
+    if (size < HEAP_MIN_BLOCK)
+        size = HEAP_MIN_BLOCK;
+
+    if (NULL == (b = heap_find(size))) {
+        if (-1 == heap_grow(size))
+            return NULL;
+        b = heap_find(size);
+    }
+    heap_unlink(b);
+
+    /* Split off the tail when it can hold a block of its own */
+    if (BLOCK_SIZE(b) - size >= HEAP_MIN_BLOCK) {
+        rest = BLOCK_AT((uint8_t*)b + size);
+        rest->header = (BLOCK_SIZE(b) - size) | HEAP_PREV_INUSE | HEAP_INUSE;
+        b->header = size | (b->header & HEAP_PREV_INUSE);
+        heap_insert(rest);
+    }
+
+    b->header |= HEAP_INUSE;
+    NEXT_BLOCK(b)->header |= HEAP_PREV_INUSE;
+    return (uint8_t*)b + 4;
+}
+
+void ece391_free(void* ptr)
+{
+    if (NULL == ptr)
+        return;
+    heap_insert(BLOCK_AT((uint8_t*)ptr - 4));
+}
@@ -11,5 +11,17 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_MMAP    11
+#define SYS_CREATE  12
+#define SYS_UNLINK  13
+#define SYS_GETDENTS 14
+#define SYS_STAT    15
+#define SYS_FSTAT   16
+#define SYS_LSEEK   17
+#define SYS_PREAD   18
+#define SYS_SBRK    19
+#define SYS_BRK     20
+#define SYS_FORK    21
+#define SYS_WAIT    22
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,32 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/*
+ * tune name=value [name=value ...]
+ * Sets kernel tunables (pit_hz, sched_quantum) through the stats file,
+ * "cat stats" shows their current values
+ */
+int main ()
+{
+    int32_t fd;
+    uint8_t buf[128];
+
+    if (0 != ece391_getargs (buf, 128) || '\0' == buf[0]) {
+        ece391_fdputs (1, (uint8_t*)"usage: tune name=value\n");
+        return 3;
+    }
+
+    if (-1 == (fd = ece391_open ((uint8_t*)"stats"))) {
+        ece391_fdputs (1, (uint8_t*)"stats file not found\n");
+        return 2;
+    }
+
+    if (-1 == ece391_write (fd, buf, ece391_strlen (buf))) {
+        ece391_fdputs (1, (uint8_t*)"rejected\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "lz.h"
+
+/*
+ * lz_decompress
+ *   DESCRIPTION: Decodes one LZ4 block. Every length and offset is checked
+ *                against both buffers, so a corrupt image can't write past dst
+ *   INPUTS: src     - compressed bytes
+ *           src_len - number of compressed bytes
+ *           dst_len - expected size of the decompressed data
+ *   OUTPUTS: dst - decompressed data
+ *   RETURN VALUE: dst_len on success, -1 if the block is corrupt
+ *   SIDE EFFECTS: none
+ */
+int32_t lz_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len) {
+    const uint8_t* ip = src;
+    const uint8_t* src_end = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* dst_end = dst + dst_len;
+    const uint8_t* match;
+    uint32_t token, length, offset;
+
+    while(ip < src_end) {
+        token = *ip++;
+
+        /* Literals */
+        length = token >> 4;
+        if(length == LZ_RUN_MASK) {
+            do {
+                if(ip >= src_end)
+                    return -1;
+                length += *ip;
+            } while(*ip++ == 255);
+        }
+        if((length > (uint32_t) (src_end - ip)) || (length > (uint32_t) (dst_end - op)))
+            return -1;
+        while(length--)
+            *op++ = *ip++;
+
+        /* The last sequence has no match */
+        if(ip == src_end)
+            break;
+
+        /* Match */
+        if(src_end - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if((offset == 0) || (offset > (uint32_t) (op - dst)))
+            return -1;
+
+        length = token & LZ_RUN_MASK;
+        if(length == LZ_RUN_MASK) {
+            do {
+                if(ip >= src_end)
+                    return -1;
+                length += *ip;
+            } while(*ip++ == 255);
+        }
+        length += LZ_MIN_MATCH;
+        if(length > (uint32_t) (dst_end - op))
+            return -1;
+
+        /* Byte by byte, matches may overlap the bytes they produce */
+        match = op - offset;
+        while(length--)
+            *op++ = *match++;
+    }
+
+    return (op == dst_end) ? (int32_t) dst_len : -1;
+}